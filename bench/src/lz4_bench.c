@@ -0,0 +1,1339 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+
+/* Throughput benchmark for the public API.
+
+     lz4_bench [options] [file ...]
+
+   Every corpus (the synthetic ones and any files given) is run through
+
+     lz4_frame        lz4_init/lz4_compress_block/lz4_finish and
+                      lz4_init_decompress/lz4_decompress/lz4_finish
+     lz4_appending    lz4_compress_appending_to_buffer and
+                      lz4_decompress_into_fixed_buffer, one call per block
+     lz4_hash64       lz4_hash64 of each block
+
+   for every level, block size and checksum flag selected.  Each measurement
+   is repeated for at least --time seconds and the fastest pass is reported
+   (MB/s are 10^6 bytes of original data per second).  Cycles per byte are
+   timestamp counter cycles on x86, or nanoseconds times --ghz if given.
+
+     lz4_bench --latency [options] [file ...]
+
+   times every call on its own for many small messages and reports the
+   distribution (p50, p99, p99.9 and max) per API and level.
+
+     lz4_bench --threads=1..N [options] [file ...]
+
+   compresses and decompresses frames on 1..N threads at once, each with its
+   own contexts, and reports the aggregate and per-thread MB/s. */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include "the-lz4-library/lz4.h"
+#include "a-memory-library/aml_buffer.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC
+#endif
+
+typedef struct {
+    const char *name;
+    char *data;
+    size_t len;
+} corpus_t;
+
+typedef struct {
+    int levels[64];
+    int num_levels;
+    lz4_block_size_t sizes[4];
+    int num_sizes;
+    /* bit 0 block checksum, bit 1 content checksum */
+    int checksums[4];
+    int num_checksums;
+    const char *corpora;
+    const char *apis;
+    size_t corpus_size;
+    double min_time;
+    double ghz;
+    bool json;
+    /* --latency */
+    bool latency;
+    size_t messages;
+    uint32_t min_message, max_message;
+    /* --threads */
+    int threads[64];
+    int num_threads;
+    bool shared_input;
+    enum { PIN_NONE, PIN_CORE, PIN_NUMA } pin;
+} bench_options_t;
+
+typedef struct {
+    const char *api;
+    const char *corpus;
+    bool has_level;
+    int level;
+    uint32_t block_size;
+    int checksums;
+    size_t bytes;
+    size_t compressed_bytes;
+    double compress_ns, decompress_ns;
+    uint64_t compress_cycles, decompress_cycles;
+} result_t;
+
+static const char *size_names[] = {"64KB", "256KB", "1MB", "4MB"};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void) {
+#ifdef BENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* times the fastest of repeated calls of fn(arg), running for at least
+   min_time seconds */
+typedef bool (*pass_f)(void *arg);
+
+static bool time_passes(pass_f fn, void *arg, double min_time, double *best_ns, uint64_t *best_cycles) {
+    uint64_t start = now_ns();
+    *best_ns = 0;
+    *best_cycles = 0;
+    do {
+        uint64_t ns = now_ns();
+        uint64_t cycles = now_cycles();
+        if (!fn(arg))
+            return false;
+        cycles = now_cycles() - cycles;
+        ns = now_ns() - ns;
+        if (!*best_ns || ns < *best_ns) {
+            *best_ns = ns ? ns : 1;
+            *best_cycles = cycles;
+        }
+    } while ((now_ns() - start) * 1e-9 < min_time);
+    return true;
+}
+
+/* synthetic corpora */
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng(void) {
+    uint64_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return rng_state = x;
+}
+
+/* a word from a small vocabulary, common words much more likely */
+static const char *random_word(void) {
+    static const char *words[] = {
+        "the", "of", "and", "to", "a", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by",
+        "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had",
+        "they", "you", "were", "their", "one", "all", "we", "can", "her", "has", "there", "been", "if",
+        "more", "when", "will", "would", "who", "so", "no", "time", "people", "system", "data", "market",
+        "between", "government", "development", "information", "during", "because", "through", "another",
+        "compression", "library", "performance", "number", "example", "important", "different", "process",
+        "following", "without", "general", "american", "century", "research", "history", "language"};
+    size_t n = sizeof(words) / sizeof(words[0]);
+    size_t a = rng() % n, b = rng() % n;
+    return words[a * b / n];
+}
+
+static void fill_text(char *dest, size_t len) {
+    size_t pos = 0, line = 0;
+    bool capital = true;
+    while (pos < len) {
+        char word[32];
+        int n = snprintf(word, sizeof(word), "%s", random_word());
+        if (capital)
+            word[0] = (char)(word[0] - 'a' + 'A');
+        capital = rng() % 12 == 0;
+        if (capital)
+            word[n++] = '.';
+        bool newline = line + n >= 72;
+        word[n++] = newline ? '\n' : ' ';
+        line = newline ? 0 : line + n;
+        if ((size_t)n > len - pos)
+            n = (int)(len - pos);
+        memcpy(dest + pos, word, n);
+        pos += n;
+    }
+}
+
+static void fill_logs(char *dest, size_t len) {
+    static const char *severity[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+    static const char *paths[] = {"/api/v1/items", "/api/v1/users", "/api/v1/search", "/healthz", "/static/app.js"};
+    size_t pos = 0;
+    uint64_t ms = 1704067200000ULL;
+    while (pos < len) {
+        char line[256];
+        ms += rng() % 50;
+        uint64_t r = rng();
+        int n = snprintf(line, sizeof(line),
+                         "%" PRIu64 ".%03u %s [worker-%u] 10.%u.%u.%u \"GET %s/%u HTTP/1.1\" %u %u bytes %u.%03ums\n",
+                         ms / 1000, (unsigned)(ms % 1000), severity[r % 6], (unsigned)(r >> 8) % 16,
+                         (unsigned)(r >> 12) % 4, (unsigned)(r >> 16) % 256, (unsigned)(r >> 24) % 256,
+                         paths[(r >> 32) % 5], (unsigned)(r >> 35) % 10000, (r >> 50) % 20 ? 200 : 404,
+                         (unsigned)(r >> 40) % 65536, (unsigned)(r >> 20) % 100, (unsigned)(r >> 4) % 1000);
+        if ((size_t)n > len - pos)
+            n = (int)(len - pos);
+        memcpy(dest + pos, line, n);
+        pos += n;
+    }
+}
+
+static void fill_json(char *dest, size_t len) {
+    static const char *tags[] = {"\"new\"", "\"sale\"", "\"featured\"", "\"clearance\"", "\"limited\""};
+    size_t pos = 0;
+    unsigned int id = 1000;
+    while (pos < len) {
+        char rec[512];
+        uint64_t r = rng();
+        id += 1 + (unsigned)(r % 3);
+        int n = snprintf(rec, sizeof(rec),
+                         "{\"id\":%u,\"name\":\"%s %s\",\"email\":\"user%u@example.com\",\"active\":%s,"
+                         "\"score\":%u.%02u,\"tags\":[%s,%s],\"address\":{\"city\":\"%s\",\"zip\":\"%05u\"}}\n",
+                         id, random_word(), random_word(), id, r & 1 ? "true" : "false", (unsigned)(r >> 8) % 100,
+                         (unsigned)(r >> 16) % 100, tags[(r >> 24) % 5], tags[(r >> 28) % 5], random_word(),
+                         (unsigned)(r >> 32) % 100000);
+        if ((size_t)n > len - pos)
+            n = (int)(len - pos);
+        memcpy(dest + pos, rec, n);
+        pos += n;
+    }
+}
+
+static void fill_random(char *dest, size_t len) {
+    for (size_t pos = 0; pos < len; pos += 8) {
+        uint64_t r = rng();
+        memcpy(dest + pos, &r, len - pos < 8 ? len - pos : 8);
+    }
+}
+
+/* a column of increasing 32 bit timestamps followed by a column of prices as
+   doubles (a random walk) */
+static void fill_numeric(char *dest, size_t len) {
+    size_t half = len / 2 / sizeof(uint32_t) * sizeof(uint32_t);
+    uint32_t t = 1704067200;
+    for (size_t pos = 0; pos < half; pos += sizeof(t)) {
+        t += (uint32_t)(rng() % 16);
+        memcpy(dest + pos, &t, sizeof(t));
+    }
+    double price = 100.0;
+    size_t pos = half;
+    for (; pos + sizeof(price) <= len; pos += sizeof(price)) {
+        price += ((double)(rng() % 201) - 100.0) / 100.0;
+        double rounded = (double)(int64_t)(price * 100.0) / 100.0;
+        memcpy(dest + pos, &rounded, sizeof(rounded));
+    }
+    memset(dest + pos, 0, len - pos);
+}
+
+static bool add_synthetic(corpus_t *c, const char *name, size_t len) {
+    c->name = name;
+    c->len = len;
+    c->data = (char *)malloc(len ? len : 1);
+    if (!strcmp(name, "text"))
+        fill_text(c->data, len);
+    else if (!strcmp(name, "logs"))
+        fill_logs(c->data, len);
+    else if (!strcmp(name, "json"))
+        fill_json(c->data, len);
+    else if (!strcmp(name, "random"))
+        fill_random(c->data, len);
+    else if (!strcmp(name, "zeros"))
+        memset(c->data, 0, len);
+    else if (!strcmp(name, "numeric"))
+        fill_numeric(c->data, len);
+    else {
+        free(c->data);
+        return false;
+    }
+    return true;
+}
+
+static bool read_corpus(corpus_t *c, const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (!in)
+        return false;
+    c->name = path;
+    c->len = 0;
+    c->data = NULL;
+    size_t size = 0;
+    while (true) {
+        if (c->len == size) {
+            size = size ? size * 2 : 1 << 20;
+            c->data = (char *)realloc(c->data, size);
+        }
+        size_t n = fread(c->data + c->len, 1, size - c->len, in);
+        if (!n)
+            break;
+        c->len += n;
+    }
+    fclose(in);
+    return true;
+}
+
+/* lz4_frame */
+
+typedef struct {
+    const corpus_t *corpus;
+    int level;
+    lz4_block_size_t size;
+    int checksums;
+    char *frame;
+    size_t frame_len;
+    char *out;
+} frame_bench_t;
+
+static bool compress_frame_pass(void *arg) {
+    frame_bench_t *b = (frame_bench_t *)arg;
+    lz4_t *c = lz4_init(b->level, b->size, b->checksums & 1, b->checksums & 2);
+    uint32_t header_size;
+    const char *header = lz4_get_header(c, &header_size);
+    memcpy(b->frame, header, header_size);
+    size_t pos = header_size;
+    uint32_t block_size = lz4_block_size(c);
+    uint32_t max_block = lz4_compressed_size(c);
+    const char *src = b->corpus->data;
+    for (size_t i = 0; i < b->corpus->len; i += block_size) {
+        uint32_t n = b->corpus->len - i < block_size ? (uint32_t)(b->corpus->len - i) : block_size;
+        pos += lz4_compress_block(c, src + i, n, b->frame + pos, max_block);
+    }
+    pos += lz4_finish(c, b->frame + pos);
+    lz4_destroy(c);
+    b->frame_len = pos;
+    return true;
+}
+
+static bool decompress_frame_pass(void *arg) {
+    frame_bench_t *b = (frame_bench_t *)arg;
+    lz4_header_t h;
+    if (!lz4_check_header(&h, b->frame, b->frame_len < LZ4_MAX_HEADER_SIZE ? b->frame_len : LZ4_MAX_HEADER_SIZE))
+        return false;
+    lz4_t *d = lz4_init_decompress(b->frame, h.header_size);
+    if (!d)
+        return false;
+    size_t pos = h.header_size, out_len = 0;
+    uint32_t block_size = lz4_block_size(d);
+    while (true) {
+        uint32_t v;
+        memcpy(&v, b->frame + pos, 4);
+        pos += 4;
+        if (!v)
+            break;
+        uint32_t n = (v & 0x7FFFFFFFU) + lz4_block_header_size(d);
+        size_t left = b->corpus->len - out_len;
+        int r = lz4_decompress(d, b->frame + pos, n, b->out + out_len, left < block_size ? (uint32_t)left : block_size,
+                               !(v & 0x80000000U));
+        if (r < 0) {
+            lz4_destroy(d);
+            return false;
+        }
+        out_len += r;
+        pos += n;
+    }
+    bool ok = lz4_finish(d, b->frame + pos) >= 0 && out_len == b->corpus->len;
+    lz4_destroy(d);
+    return ok;
+}
+
+/* lz4_appending */
+
+typedef struct {
+    const corpus_t *corpus;
+    int level;
+    uint32_t block_size;
+    aml_buffer_t *dest;
+    size_t *lens;
+    char *out;
+} appending_bench_t;
+
+static bool compress_appending_pass(void *arg) {
+    appending_bench_t *b = (appending_bench_t *)arg;
+    aml_buffer_clear(b->dest);
+    size_t block = 0;
+    for (size_t i = 0; i < b->corpus->len; i += b->block_size) {
+        int n = b->corpus->len - i < b->block_size ? (int)(b->corpus->len - i) : (int)b->block_size;
+        b->lens[block] = lz4_compress_appending_to_buffer(b->dest, b->corpus->data + i, n, b->level);
+        if (!b->lens[block++])
+            return false;
+    }
+    return true;
+}
+
+static bool decompress_appending_pass(void *arg) {
+    appending_bench_t *b = (appending_bench_t *)arg;
+    const char *src = aml_buffer_data(b->dest);
+    size_t block = 0;
+    for (size_t i = 0; i < b->corpus->len; i += b->block_size) {
+        int n = b->corpus->len - i < b->block_size ? (int)(b->corpus->len - i) : (int)b->block_size;
+        if (!lz4_decompress_into_fixed_buffer(b->out + i, n, (void *)src, (int)b->lens[block]))
+            return false;
+        src += b->lens[block++];
+    }
+    return true;
+}
+
+/* lz4_hash64 */
+
+typedef struct {
+    const corpus_t *corpus;
+    uint32_t block_size;
+    uint64_t sum;
+} hash_bench_t;
+
+static bool hash_pass(void *arg) {
+    hash_bench_t *b = (hash_bench_t *)arg;
+    for (size_t i = 0; i < b->corpus->len; i += b->block_size) {
+        size_t n = b->corpus->len - i < b->block_size ? b->corpus->len - i : b->block_size;
+        b->sum += lz4_hash64(b->corpus->data + i, n);
+    }
+    return true;
+}
+
+/* output */
+
+static int num_results;
+
+/* MB/s and cycles per byte, empty (or null) if not measured */
+static void print_rate(const bench_options_t *o, const char *name, size_t bytes, double ns, uint64_t cycles) {
+    if (o->json)
+        printf(", \"%s_mb_s\": ", name);
+    if (ns)
+        printf("%.1f", bytes / ns * 1e3);
+    else if (o->json)
+        printf("null");
+    printf(o->json ? ", \"%s_cycles_per_byte\": " : ",", name);
+    if (ns && o->ghz > 0)
+        printf("%.3f", ns * o->ghz / bytes);
+    else if (ns && cycles)
+        printf("%.3f", (double)cycles / bytes);
+    else if (o->json)
+        printf("null");
+}
+
+static void print_result(const bench_options_t *o, const result_t *r) {
+    if (o->json) {
+        printf("%s\n    {\"api\": \"%s\", \"corpus\": \"%s\", \"kernels\": \"%s\", \"level\": ", num_results ? "," : "",
+               r->api, r->corpus, lz4_kernels());
+        if (r->has_level)
+            printf("%d", r->level);
+        else
+            printf("null");
+        printf(", \"block_size\": %u, \"block_checksum\": %s, \"content_checksum\": %s, \"bytes\": %zu",
+               r->block_size, r->checksums & 1 ? "true" : "false", r->checksums & 2 ? "true" : "false", r->bytes);
+        if (r->compressed_bytes)
+            printf(", \"compressed_bytes\": %zu, \"ratio\": %.4f", r->compressed_bytes,
+                   (double)r->bytes / r->compressed_bytes);
+        else
+            printf(", \"compressed_bytes\": null, \"ratio\": null");
+        print_rate(o, "compress", r->bytes, r->compress_ns, r->compress_cycles);
+        print_rate(o, "decompress", r->bytes, r->decompress_ns, r->decompress_cycles);
+        printf("}");
+    } else {
+        if (!num_results)
+            printf("api,corpus,kernels,level,block_size,block_checksum,content_checksum,bytes,compressed_bytes,"
+                   "ratio,compress_mb_s,compress_cycles_per_byte,decompress_mb_s,decompress_cycles_per_byte\n");
+        printf("%s,%s,%s,", r->api, r->corpus, lz4_kernels());
+        if (r->has_level)
+            printf("%d", r->level);
+        printf(",%u,%d,%d,%zu,", r->block_size, r->checksums & 1, (r->checksums & 2) >> 1, r->bytes);
+        if (r->compressed_bytes)
+            printf("%zu,%.4f,", r->compressed_bytes, (double)r->bytes / r->compressed_bytes);
+        else
+            printf(",,");
+        print_rate(o, "compress", r->bytes, r->compress_ns, r->compress_cycles);
+        printf(",");
+        print_rate(o, "decompress", r->bytes, r->decompress_ns, r->decompress_cycles);
+        printf("\n");
+    }
+    fflush(stdout);
+    num_results++;
+}
+
+static bool selected(const char *list, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = list; p; p = strchr(p, ',')) {
+        if (*p == ',')
+            p++;
+        if (!strncmp(p, name, len) && (p[len] == ',' || !p[len]))
+            return true;
+    }
+    return false;
+}
+
+static uint32_t block_bytes(lz4_block_size_t size) {
+    return 65536U << (2 * size);
+}
+
+static bool bench_corpus(const bench_options_t *o, const corpus_t *c) {
+    result_t r;
+    for (int s = 0; s < o->num_sizes; s++) {
+        lz4_block_size_t size = o->sizes[s];
+        uint32_t block_size = block_bytes(size);
+        size_t num_blocks = c->len / block_size + 1;
+        char *out = (char *)malloc(c->len + 1);
+
+        if (selected(o->apis, "frame")) {
+            frame_bench_t b;
+            b.corpus = c;
+            b.size = size;
+            b.out = out;
+            b.frame = (char *)malloc(LZ4_MAX_HEADER_SIZE + 8 + num_blocks * (block_size + 8));
+            for (int l = 0; l < o->num_levels; l++) {
+                for (int k = 0; k < o->num_checksums; k++) {
+                    b.level = o->levels[l];
+                    b.checksums = o->checksums[k];
+                    memset(&r, 0, sizeof(r));
+                    if (!time_passes(compress_frame_pass, &b, o->min_time, &r.compress_ns, &r.compress_cycles) ||
+                        !time_passes(decompress_frame_pass, &b, o->min_time, &r.decompress_ns,
+                                     &r.decompress_cycles) ||
+                        memcmp(out, c->data, c->len)) {
+                        fprintf(stderr, "%s: frame round trip failed (level %d, %s)\n", c->name, b.level,
+                                size_names[size]);
+                        return false;
+                    }
+                    r.api = "lz4_frame";
+                    r.corpus = c->name;
+                    r.has_level = true;
+                    r.level = b.level;
+                    r.block_size = block_size;
+                    r.checksums = b.checksums;
+                    r.bytes = c->len;
+                    r.compressed_bytes = b.frame_len;
+                    print_result(o, &r);
+                }
+            }
+            free(b.frame);
+        }
+
+        if (selected(o->apis, "appending")) {
+            appending_bench_t b;
+            b.corpus = c;
+            b.block_size = block_size;
+            b.dest = aml_buffer_init(c->len + num_blocks * 64);
+            b.lens = (size_t *)malloc(num_blocks * sizeof(size_t));
+            b.out = out;
+            for (int l = 0; l < o->num_levels; l++) {
+                b.level = o->levels[l];
+                memset(&r, 0, sizeof(r));
+                if (!time_passes(compress_appending_pass, &b, o->min_time, &r.compress_ns, &r.compress_cycles) ||
+                    !time_passes(decompress_appending_pass, &b, o->min_time, &r.decompress_ns,
+                                 &r.decompress_cycles) ||
+                    memcmp(out, c->data, c->len)) {
+                    fprintf(stderr, "%s: appending round trip failed (level %d, %s)\n", c->name, b.level,
+                            size_names[size]);
+                    return false;
+                }
+                r.api = "lz4_appending";
+                r.corpus = c->name;
+                r.has_level = true;
+                r.level = b.level;
+                r.block_size = block_size;
+                r.bytes = c->len;
+                r.compressed_bytes = aml_buffer_length(b.dest);
+                print_result(o, &r);
+            }
+            aml_buffer_destroy(b.dest);
+            free(b.lens);
+        }
+
+        if (selected(o->apis, "hash64")) {
+            hash_bench_t b;
+            b.corpus = c;
+            b.block_size = block_size;
+            b.sum = 0;
+            memset(&r, 0, sizeof(r));
+            time_passes(hash_pass, &b, o->min_time, &r.compress_ns, &r.compress_cycles);
+            r.api = "lz4_hash64";
+            r.corpus = c->name;
+            r.block_size = block_size;
+            r.bytes = c->len;
+            print_result(o, &r);
+        }
+        free(out);
+    }
+    return true;
+}
+
+/* latency (--latency)
+
+   Messages of min_message to max_message bytes (spread evenly over the
+   powers of two in between) are taken from random offsets of each corpus.
+   Each message is compressed and then decompressed with every API, and each
+   call is timed on its own, including any context setup the API does. */
+
+/* log-linear histogram of nanoseconds as in HdrHistogram, 32 sub-buckets per
+   power of two (values are within 3%) */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+
+typedef struct {
+    uint64_t counts[64 * HIST_SUB];
+    uint64_t count, sum, min, max;
+} histogram_t;
+
+static size_t hist_index(uint64_t v) {
+    if (v < HIST_SUB)
+        return v;
+    int e = 63 - __builtin_clzll(v);
+    return ((size_t)(e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* the largest value in bucket i */
+static uint64_t hist_upper(size_t i) {
+    if (i < HIST_SUB)
+        return i;
+    int shift = (int)(i >> HIST_SUB_BITS) - 1;
+    return (((uint64_t)HIST_SUB + (i & (HIST_SUB - 1)) + 1) << shift) - 1;
+}
+
+static void hist_record(histogram_t *h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    if (!h->count || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->count++;
+    h->sum += v;
+}
+
+static uint64_t hist_percentile(const histogram_t *h, double p) {
+    uint64_t target = (uint64_t)(p / 100.0 * h->count + 0.5), seen = 0;
+    if (!target)
+        target = 1;
+    for (size_t i = 0; i < 64 * HIST_SUB; i++) {
+        seen += h->counts[i];
+        if (seen >= target)
+            return hist_upper(i) < h->max ? hist_upper(i) : h->max;
+    }
+    return h->max;
+}
+
+typedef struct {
+    size_t offset;
+    uint32_t len;
+} message_t;
+
+typedef struct {
+    int level;
+    /* the message */
+    const char *src;
+    uint32_t len;
+    /* compressed message */
+    aml_buffer_t *compressed;
+    /* decompressed message */
+    char *out;
+    aml_buffer_t *record;
+    const char *result;
+    /* long lived contexts for lz4_block */
+    lz4_t *c, *d;
+} latency_state_t;
+
+typedef bool (*latency_f)(latency_state_t *st);
+
+static bool compress_appending(latency_state_t *st) {
+    aml_buffer_clear(st->compressed);
+    return lz4_compress_appending_to_buffer(st->compressed, (void *)st->src, st->len, st->level) > 0;
+}
+
+static bool decompress_appending(latency_state_t *st) {
+    st->result = st->out;
+    return lz4_decompress_into_fixed_buffer(st->out, st->len, aml_buffer_data(st->compressed),
+                                            (int)aml_buffer_length(st->compressed));
+}
+
+static bool compress_record(latency_state_t *st) {
+    aml_buffer_clear(st->compressed);
+    return lz4_compress_record_appending_to_buffer(st->compressed, st->src, st->len, st->level, false) > 0;
+}
+
+static bool decompress_record(latency_state_t *st) {
+    aml_buffer_clear(st->record);
+    bool ok = lz4_decompress_record_appending_to_buffer(st->record, aml_buffer_data(st->compressed),
+                                                        aml_buffer_length(st->compressed));
+    st->result = aml_buffer_data(st->record);
+    return ok && aml_buffer_length(st->record) == st->len;
+}
+
+/* a block of a frame whose contexts live across messages */
+static bool compress_block(latency_state_t *st) {
+    uint32_t max_len = lz4_compressed_size(st->c);
+    aml_buffer_resize(st->compressed, max_len);
+    uint32_t n = lz4_compress_block(st->c, st->src, st->len, aml_buffer_data(st->compressed), max_len);
+    aml_buffer_resize(st->compressed, n);
+    return n > 0;
+}
+
+static bool decompress_block(latency_state_t *st) {
+    const char *block = aml_buffer_data(st->compressed);
+    uint32_t v;
+    memcpy(&v, block, 4);
+    st->result = st->out;
+    return lz4_decompress(st->d, block + 4, (v & 0x7FFFFFFFU) + lz4_block_header_size(st->d), st->out, st->len,
+                          !(v & 0x80000000U)) == (int)st->len;
+}
+
+/* a frame per message, with its own contexts */
+static bool compress_frame(latency_state_t *st) {
+    lz4_t *c = lz4_init(st->level, s64kb, false, false);
+    uint32_t header_size, max_len = lz4_compressed_size(c);
+    const char *header = lz4_get_header(c, &header_size);
+    aml_buffer_resize(st->compressed, header_size + max_len + 4);
+    char *p = aml_buffer_data(st->compressed);
+    memcpy(p, header, header_size);
+    uint32_t n = header_size + lz4_compress_block(c, st->src, st->len, p + header_size, max_len);
+    n += lz4_finish(c, p + n);
+    lz4_destroy(c);
+    aml_buffer_resize(st->compressed, n);
+    return true;
+}
+
+static bool decompress_frame(latency_state_t *st) {
+    char *p = aml_buffer_data(st->compressed);
+    lz4_header_t h;
+    if (!lz4_check_header(&h, p, aml_buffer_length(st->compressed)))
+        return false;
+    lz4_t *d = lz4_init_decompress(p, h.header_size);
+    if (!d)
+        return false;
+    p += h.header_size;
+    uint32_t v;
+    memcpy(&v, p, 4);
+    uint32_t n = (v & 0x7FFFFFFFU) + lz4_block_header_size(d);
+    bool ok = lz4_decompress(d, p + 4, n, st->out, st->len, !(v & 0x80000000U)) == (int)st->len &&
+              lz4_finish(d, p + 4 + n) >= 0;
+    lz4_destroy(d);
+    st->result = st->out;
+    return ok;
+}
+
+static void print_latency(const bench_options_t *o, const char *api, const char *operation, const char *corpus,
+                          int level, const histogram_t *h) {
+    if (o->json)
+        printf("%s\n    {\"api\": \"%s\", \"operation\": \"%s\", \"corpus\": \"%s\", \"kernels\": \"%s\", "
+               "\"level\": %d, \"messages\": %" PRIu64 ", \"min_ns\": %" PRIu64 ", \"mean_ns\": %.1f, "
+               "\"p50_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", \"p999_ns\": %" PRIu64
+               ", \"max_ns\": %" PRIu64 "}",
+               num_results ? "," : "", api, operation, corpus, lz4_kernels(), level, h->count, h->min,
+               (double)h->sum / h->count, hist_percentile(h, 50), hist_percentile(h, 90), hist_percentile(h, 99),
+               hist_percentile(h, 99.9), h->max);
+    else {
+        if (!num_results)
+            printf("api,operation,corpus,kernels,level,messages,min_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,"
+                   "max_ns\n");
+        printf("%s,%s,%s,%s,%d,%" PRIu64 ",%" PRIu64 ",%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+               ",%" PRIu64 "\n",
+               api, operation, corpus, lz4_kernels(), level, h->count, h->min, (double)h->sum / h->count,
+               hist_percentile(h, 50), hist_percentile(h, 90), hist_percentile(h, 99), hist_percentile(h, 99.9),
+               h->max);
+    }
+    fflush(stdout);
+    num_results++;
+}
+
+static bool bench_latency(const bench_options_t *o, const corpus_t *c) {
+    static const struct {
+        const char *name;
+        const char *api;
+        latency_f compress, decompress;
+    } apis[] = {{"appending", "lz4_appending", compress_appending, decompress_appending},
+                {"record", "lz4_record", compress_record, decompress_record},
+                {"block", "lz4_block", compress_block, decompress_block},
+                {"frame", "lz4_frame", compress_frame, decompress_frame}};
+    if (!c->len)
+        return true;
+
+    /* the same messages are used for every api and level */
+    message_t *messages = (message_t *)malloc(o->messages * sizeof(message_t));
+    uint32_t max_message = c->len < o->max_message ? (uint32_t)c->len : o->max_message;
+    uint32_t min_message = o->min_message < max_message ? o->min_message : max_message;
+    int octaves = 0;
+    while (((uint64_t)min_message << (octaves + 1)) <= max_message)
+        octaves++;
+    for (size_t i = 0; i < o->messages; i++) {
+        uint64_t lo = (uint64_t)min_message << (octaves ? rng() % octaves : 0);
+        uint64_t hi = lo * 2 - 1 < max_message ? lo * 2 - 1 : max_message;
+        messages[i].len = (uint32_t)(lo + rng() % (hi - lo + 1));
+        messages[i].offset = rng() % (c->len - messages[i].len + 1);
+    }
+
+    latency_state_t st;
+    memset(&st, 0, sizeof(st));
+    st.compressed = aml_buffer_init(lz4_compress_bound(max_message) + 64);
+    st.record = aml_buffer_init(max_message);
+    st.out = (char *)malloc(max_message);
+    histogram_t *compress = (histogram_t *)malloc(sizeof(histogram_t));
+    histogram_t *decompress = (histogram_t *)malloc(sizeof(histogram_t));
+    bool ok = true;
+    for (size_t a = 0; a < sizeof(apis) / sizeof(apis[0]) && ok; a++) {
+        if (!selected(o->apis, apis[a].name))
+            continue;
+        for (int l = 0; l < o->num_levels && ok; l++) {
+            st.level = o->levels[l];
+            st.c = lz4_init(st.level, s64kb, false, false);
+            uint32_t header_size;
+            const char *header = lz4_get_header(st.c, &header_size);
+            st.d = lz4_init_decompress((void *)header, header_size);
+            memset(compress, 0, sizeof(histogram_t));
+            memset(decompress, 0, sizeof(histogram_t));
+            for (size_t i = 0; i < o->messages && ok; i++) {
+                st.src = c->data + messages[i].offset;
+                st.len = messages[i].len;
+                uint64_t start = now_ns();
+                ok = apis[a].compress(&st);
+                uint64_t mid = now_ns();
+                ok = ok && apis[a].decompress(&st);
+                uint64_t end = now_ns();
+                hist_record(compress, mid - start);
+                hist_record(decompress, end - mid);
+                ok = ok && !memcmp(st.result, st.src, st.len);
+            }
+            lz4_destroy(st.c);
+            lz4_destroy(st.d);
+            if (!ok) {
+                fprintf(stderr, "%s: %s round trip failed (level %d)\n", c->name, apis[a].api, st.level);
+                break;
+            }
+            print_latency(o, apis[a].api, "compress", c->name, st.level, compress);
+            print_latency(o, apis[a].api, "decompress", c->name, st.level, decompress);
+        }
+    }
+    free(compress);
+    free(decompress);
+    free(st.out);
+    aml_buffer_destroy(st.record);
+    aml_buffer_destroy(st.compressed);
+    free(messages);
+    return ok;
+}
+
+/* thread scaling (--threads)
+
+   Each thread has its own compression and decompression contexts and works
+   through the blocks of the corpus (its own copy unless --shared) until the
+   time is up.  Private copies are made and compressed by the thread which
+   uses them, so that they are local to its NUMA node when it is pinned. */
+
+#ifdef __linux__
+/* the cpus threads are pinned to, by core or by NUMA node */
+static cpu_set_t pin_sets[CPU_SETSIZE];
+static int num_pin_sets;
+
+/* parses a sysfs cpu list such as "0-3,8-11" */
+static void parse_cpulist(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s >= '0' && *s <= '9') {
+        char *end;
+        long a = strtol(s, &end, 10), b = a;
+        if (*end == '-')
+            b = strtol(end + 1, &end, 10);
+        for (long cpu = a; cpu <= b && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, set);
+        s = *end == ',' ? end + 1 : end;
+    }
+}
+
+static bool init_pinning(const bench_options_t *o) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        return false;
+    num_pin_sets = 0;
+    if (o->pin == PIN_NUMA) {
+        for (int node = 0; node < CPU_SETSIZE; node++) {
+            char path[64], list[4096];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            FILE *in = fopen(path, "r");
+            if (!in)
+                continue;
+            size_t n = fread(list, 1, sizeof(list) - 1, in);
+            fclose(in);
+            list[n] = 0;
+            cpu_set_t *set = pin_sets + num_pin_sets;
+            parse_cpulist(list, set);
+            CPU_AND(set, set, &allowed);
+            if (CPU_COUNT(set))
+                num_pin_sets++;
+        }
+        /* no NUMA information, a single node */
+        if (!num_pin_sets)
+            pin_sets[num_pin_sets++] = allowed;
+    } else {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                CPU_ZERO(pin_sets + num_pin_sets);
+                CPU_SET(cpu, pin_sets + num_pin_sets);
+                num_pin_sets++;
+            }
+        }
+    }
+    return num_pin_sets > 0;
+}
+
+static void pin_thread(const bench_options_t *o, int index) {
+    if (o->pin != PIN_NONE)
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), pin_sets + index % num_pin_sets);
+}
+#else
+static bool init_pinning(const bench_options_t *o) {
+    (void)o;
+    return false;
+}
+
+static void pin_thread(const bench_options_t *o, int index) {
+    (void)o;
+    (void)index;
+}
+#endif
+
+/* the compressed blocks of a corpus, each starting with its size word */
+typedef struct {
+    char *data;
+    size_t *offsets;
+    size_t num_blocks;
+} blocks_t;
+
+static void compress_blocks(blocks_t *b, lz4_t *c, const char *src, size_t len) {
+    uint32_t block_size = lz4_block_size(c), max_block = lz4_compressed_size(c);
+    b->num_blocks = len ? (len - 1) / block_size + 1 : 0;
+    b->data = (char *)malloc(b->num_blocks * max_block + 1);
+    b->offsets = (size_t *)malloc((b->num_blocks + 1) * sizeof(size_t));
+    size_t pos = 0;
+    for (size_t i = 0; i < b->num_blocks; i++) {
+        size_t n = len - i * block_size < block_size ? len - i * block_size : block_size;
+        b->offsets[i] = pos;
+        pos += lz4_compress_block(c, src + i * block_size, (uint32_t)n, b->data + pos, max_block);
+    }
+    b->offsets[b->num_blocks] = pos;
+}
+
+static void free_blocks(blocks_t *b) {
+    free(b->data);
+    free(b->offsets);
+}
+
+typedef struct {
+    const bench_options_t *o;
+    const corpus_t *corpus;
+    int level;
+    lz4_block_size_t size;
+    bool decompress;
+    /* the corpus compressed once, if the input is shared */
+    blocks_t shared;
+    pthread_barrier_t start;
+    atomic_bool stop;
+} scaling_run_t;
+
+typedef struct {
+    pthread_t thread;
+    scaling_run_t *run;
+    int index;
+    uint64_t bytes;
+    uint64_t ns;
+    bool ok;
+} scaling_thread_t;
+
+static void *scaling_thread(void *arg) {
+    scaling_thread_t *t = (scaling_thread_t *)arg;
+    scaling_run_t *run = t->run;
+    pin_thread(run->o, t->index);
+
+    lz4_t *c = lz4_init(run->level, run->size, false, false);
+    uint32_t header_size;
+    const char *header = lz4_get_header(c, &header_size);
+    lz4_t *d = lz4_init_decompress((void *)header, header_size);
+    uint32_t block_size = lz4_block_size(c), max_block = lz4_compressed_size(c);
+    const char *src = run->corpus->data;
+    size_t len = run->corpus->len;
+    char *copy = NULL;
+    blocks_t private_blocks, *blocks = &run->shared;
+    if (!run->o->shared_input) {
+        copy = (char *)malloc(len + 1);
+        memcpy(copy, src, len);
+        src = copy;
+        if (run->decompress) {
+            compress_blocks(&private_blocks, c, src, len);
+            blocks = &private_blocks;
+        }
+    }
+    char *out = (char *)malloc(max_block > block_size ? max_block : block_size);
+    size_t num_blocks = len ? (len - 1) / block_size + 1 : 0;
+
+    pthread_barrier_wait(&run->start);
+    uint64_t start = now_ns(), bytes = 0;
+    t->ok = true;
+    for (size_t i = 0; num_blocks && !atomic_load_explicit(&run->stop, memory_order_relaxed);
+         i = i + 1 < num_blocks ? i + 1 : 0) {
+        uint32_t n = len - i * block_size < block_size ? (uint32_t)(len - i * block_size) : block_size;
+        if (run->decompress) {
+            const char *block = blocks->data + blocks->offsets[i];
+            uint32_t v;
+            memcpy(&v, block, 4);
+            if (lz4_decompress(d, block + 4, (v & 0x7FFFFFFFU) + lz4_block_header_size(d), out, n,
+                               !(v & 0x80000000U)) != (int)n) {
+                t->ok = false;
+                break;
+            }
+        } else
+            lz4_compress_block(c, src + i * block_size, n, out, max_block);
+        bytes += n;
+    }
+    t->ns = now_ns() - start;
+    t->bytes = bytes;
+
+    free(out);
+    if (copy) {
+        if (run->decompress)
+            free_blocks(&private_blocks);
+        free(copy);
+    }
+    lz4_destroy(c);
+    lz4_destroy(d);
+    return NULL;
+}
+
+static void print_scaling(const bench_options_t *o, const scaling_run_t *run, int num_threads,
+                          const scaling_thread_t *threads, uint64_t wall_ns) {
+    static const char *pins[] = {"none", "core", "numa"};
+    uint64_t bytes = 0;
+    double min = 0, max = 0;
+    for (int i = 0; i < num_threads; i++) {
+        double mb_s = threads[i].bytes * 1e3 / (threads[i].ns ? threads[i].ns : 1);
+        bytes += threads[i].bytes;
+        if (!i || mb_s < min)
+            min = mb_s;
+        if (mb_s > max)
+            max = mb_s;
+    }
+    double aggregate = bytes * 1e3 / wall_ns;
+    const char *operation = run->decompress ? "decompress" : "compress";
+    const char *input = o->shared_input ? "shared" : "private";
+    if (o->json)
+        printf("%s\n    {\"api\": \"lz4_frame\", \"operation\": \"%s\", \"corpus\": \"%s\", \"kernels\": \"%s\", "
+               "\"level\": %d, \"block_size\": %u, \"threads\": %d, \"input\": \"%s\", \"pin\": \"%s\", "
+               "\"bytes\": %" PRIu64 ", \"aggregate_mb_s\": %.1f, \"min_thread_mb_s\": %.1f, "
+               "\"max_thread_mb_s\": %.1f, \"thread_mb_s\": [",
+               num_results ? "," : "", operation, run->corpus->name, lz4_kernels(), run->level,
+               block_bytes(run->size), num_threads, input, pins[o->pin], bytes, aggregate, min, max);
+    else {
+        if (!num_results)
+            printf("api,operation,corpus,kernels,level,block_size,threads,input,pin,bytes,aggregate_mb_s,"
+                   "min_thread_mb_s,max_thread_mb_s,thread_mb_s\n");
+        printf("lz4_frame,%s,%s,%s,%d,%u,%d,%s,%s,%" PRIu64 ",%.1f,%.1f,%.1f,", operation, run->corpus->name,
+               lz4_kernels(), run->level, block_bytes(run->size), num_threads, input, pins[o->pin], bytes,
+               aggregate, min, max);
+    }
+    /* per thread, space separated in csv */
+    for (int i = 0; i < num_threads; i++)
+        printf("%s%.1f", i ? (o->json ? ", " : " ") : "",
+               threads[i].bytes * 1e3 / (threads[i].ns ? threads[i].ns : 1));
+    printf(o->json ? "]}" : "\n");
+    fflush(stdout);
+    num_results++;
+}
+
+static bool bench_scaling(const bench_options_t *o, const corpus_t *c) {
+    if (!c->len)
+        return true;
+    scaling_thread_t *threads = (scaling_thread_t *)malloc(sizeof(scaling_thread_t) * o->threads[o->num_threads - 1]);
+    bool ok = true;
+    for (int s = 0; s < o->num_sizes && ok; s++) {
+        for (int l = 0; l < o->num_levels && ok; l++) {
+            scaling_run_t run;
+            run.o = o;
+            run.corpus = c;
+            run.size = o->sizes[s];
+            run.level = o->levels[l];
+            if (o->shared_input) {
+                lz4_t *cctx = lz4_init(run.level, run.size, false, false);
+                compress_blocks(&run.shared, cctx, c->data, c->len);
+                lz4_destroy(cctx);
+            }
+            for (int decompress = 0; decompress < 2 && ok; decompress++) {
+                run.decompress = decompress;
+                for (int n = 0; n < o->num_threads && ok; n++) {
+                    int num_threads = o->threads[n];
+                    pthread_barrier_init(&run.start, NULL, num_threads + 1);
+                    atomic_store(&run.stop, false);
+                    for (int i = 0; i < num_threads; i++) {
+                        threads[i].run = &run;
+                        threads[i].index = i;
+                        pthread_create(&threads[i].thread, NULL, scaling_thread, threads + i);
+                    }
+                    pthread_barrier_wait(&run.start);
+                    uint64_t start = now_ns();
+                    struct timespec ts;
+                    ts.tv_sec = (time_t)o->min_time;
+                    ts.tv_nsec = (long)((o->min_time - ts.tv_sec) * 1e9);
+                    nanosleep(&ts, NULL);
+                    atomic_store(&run.stop, true);
+                    for (int i = 0; i < num_threads; i++) {
+                        pthread_join(threads[i].thread, NULL);
+                        ok = ok && threads[i].ok;
+                    }
+                    uint64_t wall_ns = now_ns() - start;
+                    pthread_barrier_destroy(&run.start);
+                    if (!ok)
+                        fprintf(stderr, "%s: decompression failed (level %d)\n", c->name, run.level);
+                    else
+                        print_scaling(o, &run, num_threads, threads, wall_ns);
+                }
+            }
+            if (o->shared_input)
+                free_blocks(&run.shared);
+        }
+    }
+    free(threads);
+    return ok;
+}
+
+/* parses a list of numbers and ranges, "-5,1,3..9" */
+static int parse_levels(const char *s, int *levels, int max) {
+    int n = 0;
+    while (*s) {
+        char *end;
+        long a = strtol(s, &end, 10), b = a;
+        if (end == s)
+            return 0;
+        if (end[0] == '.' && end[1] == '.') {
+            s = end + 2;
+            b = strtol(s, &end, 10);
+            if (end == s || b < a)
+                return 0;
+        }
+        for (long v = a; v <= b; v++) {
+            if (n == max)
+                return 0;
+            levels[n++] = (int)v;
+        }
+        s = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',')
+            return 0;
+    }
+    return n;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options] [file ...]\n"
+            "  --levels=LIST        levels and ranges (default -20,-10,-5,-2,-1,1,3..12)\n"
+            "  --block-sizes=LIST   64KB,256KB,1MB,4MB (default all)\n"
+            "  --checksums=LIST     none,block,content,both (default all)\n"
+            "  --corpora=LIST       text,logs,json,random,zeros,numeric (default all, none for\n"
+            "                       only the files given)\n"
+            "  --apis=LIST          frame,appending,hash64 (default all)\n"
+            "  --size=MB            size of each synthetic corpus (default 8)\n"
+            "  --time=SECONDS       minimum time of each measurement (default 0.2)\n"
+            "  --ghz=GHZ            report cycles as nanoseconds * GHZ instead of the timestamp counter\n"
+            "  --kernels=NAME       block kernels to use (see lz4_set_kernels)\n"
+            "  --json               JSON instead of CSV\n"
+            "latency (--latency, the block size, checksum and time options don't apply):\n"
+            "  --levels=LIST        (default -5,1,9)\n"
+            "  --apis=LIST          appending,record,block,frame (default all)\n"
+            "  --messages=N         messages per api and level (default 1000000)\n"
+            "  --message-sizes=A..B message sizes (default 64..16384)\n"
+            "thread scaling (--threads=LIST, the checksum options don't apply):\n"
+            "  --threads=LIST       thread counts, \"max\" is one per cpu (1,2,4,..,max if empty)\n"
+            "  --levels=LIST        (default -5,1,9)\n"
+            "  --block-sizes=LIST   (default 64KB)\n"
+            "  --time=SECONDS       time of each run (default 1)\n"
+            "  --shared             all threads read one copy of the input (default a copy each)\n"
+            "  --pin=core|numa      pin thread i to the i-th cpu or NUMA node\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    bench_options_t o;
+    memset(&o, 0, sizeof(o));
+    o.num_levels = parse_levels("-20,-10,-5,-2,-1,1,3..12", o.levels, 64);
+    for (int i = 0; i < 4; i++) {
+        o.sizes[i] = (lz4_block_size_t)i;
+        o.checksums[i] = i;
+    }
+    o.num_sizes = o.num_checksums = 4;
+    o.corpora = "text,logs,json,random,zeros,numeric";
+    o.apis = "frame,appending,hash64";
+    o.corpus_size = 8 << 20;
+    o.min_time = 0.2;
+    o.messages = 1000000;
+    o.min_message = 64;
+    o.max_message = 16384;
+    bool levels_set = false, apis_set = false, sizes_set = false, time_set = false;
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 1)
+        num_cpus = 1;
+
+    corpus_t *corpora = (corpus_t *)calloc(argc + 6, sizeof(corpus_t));
+    int num_corpora = 0;
+    const char *files[argc];
+    int num_files = 0;
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (!strncmp(a, "--levels=", 9)) {
+            o.num_levels = parse_levels(a + 9, o.levels, 64);
+            levels_set = true;
+            if (!o.num_levels) {
+                usage(argv[0]);
+                return 2;
+            }
+        } else if (!strncmp(a, "--block-sizes=", 14)) {
+            sizes_set = true;
+            o.num_sizes = 0;
+            for (int s = 0; s < 4; s++)
+                if (selected(a + 14, size_names[s]))
+                    o.sizes[o.num_sizes++] = (lz4_block_size_t)s;
+        } else if (!strncmp(a, "--checksums=", 12)) {
+            static const char *names[] = {"none", "block", "content", "both"};
+            o.num_checksums = 0;
+            for (int k = 0; k < 4; k++)
+                if (selected(a + 12, names[k]))
+                    o.checksums[o.num_checksums++] = k;
+        } else if (!strncmp(a, "--corpora=", 10))
+            o.corpora = a + 10;
+        else if (!strncmp(a, "--apis=", 7)) {
+            o.apis = a + 7;
+            apis_set = true;
+        } else if (!strcmp(a, "--latency"))
+            o.latency = true;
+        else if (!strncmp(a, "--messages=", 11))
+            o.messages = strtoull(a + 11, NULL, 10);
+        else if (!strncmp(a, "--message-sizes=", 16)) {
+            int sizes[2];
+            if (parse_levels(a + 16, sizes, 2) != 2 || sizes[0] <= 0 || sizes[1] > 65536) {
+                usage(argv[0]);
+                return 2;
+            }
+            o.min_message = sizes[0];
+            o.max_message = sizes[1];
+        }
+        else if (!strncmp(a, "--size=", 7))
+            o.corpus_size = (size_t)(atof(a + 7) * 1024 * 1024);
+        else if (!strncmp(a, "--time=", 7)) {
+            o.min_time = atof(a + 7);
+            time_set = true;
+        } else if (!strncmp(a, "--threads", 9) && (!a[9] || a[9] == '=')) {
+            /* "max" is the number of cpus */
+            char list[256];
+            const char *p = a[9] ? a + 10 : "";
+            size_t n = 0;
+            for (; *p && n + 24 < sizeof(list); p++) {
+                if (!strncmp(p, "max", 3)) {
+                    n += snprintf(list + n, sizeof(list) - n, "%ld", num_cpus);
+                    p += 2;
+                } else
+                    list[n++] = *p;
+            }
+            list[n] = 0;
+            if (n) {
+                o.num_threads = parse_levels(list, o.threads, 64);
+                if (!o.num_threads || o.threads[0] < 1) {
+                    usage(argv[0]);
+                    return 2;
+                }
+            } else {
+                for (long t = 1; t < num_cpus && o.num_threads < 63; t *= 2)
+                    o.threads[o.num_threads++] = (int)t;
+                o.threads[o.num_threads++] = (int)num_cpus;
+            }
+        } else if (!strcmp(a, "--shared"))
+            o.shared_input = true;
+        else if (!strcmp(a, "--pin=core"))
+            o.pin = PIN_CORE;
+        else if (!strcmp(a, "--pin=numa"))
+            o.pin = PIN_NUMA;
+        else if (!strncmp(a, "--ghz=", 6))
+            o.ghz = atof(a + 6);
+        else if (!strncmp(a, "--kernels=", 10)) {
+            if (!lz4_set_kernels(a + 10)) {
+                fprintf(stderr, "kernels %s are not available\n", a + 10);
+                return 2;
+            }
+        } else if (!strcmp(a, "--json"))
+            o.json = true;
+        else if (a[0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else
+            files[num_files++] = a;
+    }
+    if (!o.num_sizes || !o.num_checksums || !o.messages) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (o.num_threads) {
+        if (!levels_set)
+            o.num_levels = parse_levels("-5,1,9", o.levels, 64);
+        if (!sizes_set)
+            o.num_sizes = 1;
+        if (!time_set)
+            o.min_time = 1;
+        /* thread counts ascending without duplicates, the last is the largest */
+        for (int i = 1; i < o.num_threads; i++)
+            for (int j = i; j > 0 && o.threads[j] < o.threads[j - 1]; j--) {
+                int t = o.threads[j];
+                o.threads[j] = o.threads[j - 1];
+                o.threads[j - 1] = t;
+            }
+        int n = 1;
+        for (int i = 1; i < o.num_threads; i++)
+            if (o.threads[i] != o.threads[n - 1])
+                o.threads[n++] = o.threads[i];
+        o.num_threads = n;
+        if (o.pin != PIN_NONE && !init_pinning(&o)) {
+            fprintf(stderr, "pinning is not supported\n");
+            return 2;
+        }
+    } else if (o.latency) {
+        if (!levels_set)
+            o.num_levels = parse_levels("-5,1,9", o.levels, 64);
+        if (!apis_set)
+            o.apis = "appending,record,block,frame";
+    }
+
+    static const char *synthetic[] = {"text", "logs", "json", "random", "zeros", "numeric"};
+    for (int i = 0; i < 6; i++)
+        if (selected(o.corpora, synthetic[i]))
+            add_synthetic(corpora + num_corpora++, synthetic[i], o.corpus_size);
+    for (int i = 0; i < num_files; i++) {
+        if (!read_corpus(corpora + num_corpora, files[i])) {
+            fprintf(stderr, "unable to read %s\n", files[i]);
+            return 2;
+        }
+        num_corpora++;
+    }
+
+    if (o.json)
+        printf("{\"results\": [");
+    bool ok = true;
+    for (int i = 0; i < num_corpora && ok; i++)
+        ok = o.num_threads ? bench_scaling(&o, corpora + i)
+             : o.latency   ? bench_latency(&o, corpora + i)
+                           : bench_corpus(&o, corpora + i);
+    if (o.json)
+        printf("\n]}\n");
+
+    for (int i = 0; i < num_corpora; i++)
+        free(corpora[i].data);
+    free(corpora);
+    return ok ? 0 : 1;
+}
@@ -15,11 +15,54 @@ extern "C" {
 
 uint64_t lz4_hash64(const void *s, size_t len);
 
+/* out[i] = lz4_hash64(keys[i], lens[i]) for n keys.  Several keys are hashed
+   at once, which is much faster than calling lz4_hash64 for short keys. */
+void lz4_hash64_batch(const void *const *keys, const size_t *lens,
+                      uint64_t *out, size_t n);
+
+/* same for n keys of key_len bytes stored one after another in keys */
+void lz4_hash64_batch_fixed(const void *keys, size_t key_len, uint64_t *out,
+                            size_t n);
+
 int lz4_compress_bound(int inputSize);
 
+/* The block compressors and decompressors are built for the baseline cpu
+   and, on x86-64, also with AVX2 and BMI2 (32 byte copies and match length
+   comparisons).  The AVX2 build is selected when the library is loaded if
+   the cpu supports it.  Both produce the same output.
+
+   lz4_kernels returns the name of the selected build ("baseline" or
+   "avx2").  lz4_set_kernels selects one by name (for tests and benchmarks,
+   it must not be called while other threads compress or decompress) and
+   returns false if it isn't available. */
+const char *lz4_kernels(void);
+bool lz4_set_kernels(const char *name);
+
 size_t lz4_compress_appending_to_buffer(aml_buffer_t *dest, void *src, int src_size, int level);
 bool lz4_decompress_into_fixed_buffer(void *dest, int dest_size, void *src, int src_size);
 
+/* Self-describing records.  A record is
+
+     varint    original size (LEB128, at most 5 bytes)
+     uint8_t   flags: 0x80 checksum present, 0x40 stored uncompressed,
+               the low 4 bits are the level used to compress it
+     uint32_t  XXH32 of the original data (if the checksum flag is set)
+     ...       the compressed (or stored) data
+
+   so the caller doesn't need to keep the original size elsewhere.  Records
+   which don't compress are stored.  Returns the size of the record appended
+   to dest or 0 on failure. */
+size_t lz4_compress_record_appending_to_buffer(aml_buffer_t *dest, const void *src, int src_size,
+                                               int level, bool checksum);
+
+/* appends the original data of the record to dest, sizing dest once from the
+   record header.  dest is unchanged if the record is invalid or the checksum
+   doesn't match. */
+bool lz4_decompress_record_appending_to_buffer(aml_buffer_t *dest, const void *src, size_t src_size);
+
+/* returns the original size of a record or -1 if the header is invalid */
+int64_t lz4_record_size(const void *src, size_t src_size);
+
 
 enum lz4_block_size_s { s64kb = 0, s256kb = 1, s1mb = 2, s4mb = 3 };
 typedef enum lz4_block_size_s lz4_block_size_t;
@@ -32,18 +75,46 @@ uint32_t lz4_block_size(lz4_t *r);
 uint32_t lz4_block_header_size(lz4_t *r);
 uint32_t lz4_compressed_size(lz4_t *r);
 
+/* the largest frame header (with content size and dictionary id) */
+#define LZ4_MAX_HEADER_SIZE 19
+
 typedef struct {
   uint32_t block_size;
   uint32_t compressed_size;
   lz4_block_size_t size;
   bool block_checksum;
   bool content_checksum;
+  bool linked_blocks;
+  /* the decompressed size of the frame, if known */
+  bool has_content_size;
+  uint64_t content_size;
+  /* the dictionary the frame was compressed with, if any */
+  bool has_dict_id;
+  uint32_t dict_id;
   char *header;
+  uint32_t header_size;
 } lz4_header_t;
 
+/* returns the size of the frame header which starts at header (7 to 19 bytes)
+   or 0 if len is less than 5 or header isn't an LZ4 frame.  Only the first 5
+   bytes are needed. */
+uint32_t lz4_header_size(const void *header, uint32_t len);
+
+/* parses the frame descriptor and verifies its checksum.  header_size may be
+   larger than the header, the actual size is returned in r->header_size. */
 bool lz4_check_header(lz4_header_t *r, void *header,
                          uint32_t header_size);
 
+/* writes the frame header described by size, block_checksum,
+   content_checksum, linked_blocks, has_content_size/content_size and
+   has_dict_id/dict_id to dest (which must have LZ4_MAX_HEADER_SIZE bytes) and
+   returns its length */
+uint32_t lz4_write_header(void *dest, const lz4_header_t *h);
+
+/* records the decompressed size of the frame in the header, call before
+   lz4_get_header.  Decoders can then allocate the output once. */
+void lz4_set_content_size(lz4_t *r, uint64_t content_size);
+
 #ifdef _AML_DEBUG_
 #define lz4_init(level, size, block_checksum, content_checksum)             \
   _lz4_init(level, size, block_checksum, content_checksum,                  \
@@ -57,6 +128,58 @@ lz4_t *_lz4_init(int level, lz4_block_size_t size, bool block_checksum,
                        bool content_checksum);
 #endif
 
+/* Like lz4_init, except that blocks are not independent.  Each block may
+   reference up to 64KB of the data before it, which improves the ratio of
+   small blocks.  The frame header clears the block independence flag and the
+   blocks must be decompressed in order. */
+#ifdef _AML_DEBUG_
+#define lz4_init_linked(level, size, block_checksum, content_checksum)      \
+  _lz4_init_linked(level, size, block_checksum, content_checksum,           \
+                   aml_file_line_func("lz4_linked"))
+lz4_t *_lz4_init_linked(int level, lz4_block_size_t size,
+                        bool block_checksum, bool content_checksum,
+                        const char *caller);
+#else
+#define lz4_init_linked(level, size, block_checksum, content_checksum)      \
+  _lz4_init_linked(level, size, block_checksum, content_checksum)
+lz4_t *_lz4_init_linked(int level, lz4_block_size_t size,
+                        bool block_checksum, bool content_checksum);
+#endif
+
+/* Like lz4_init, except that the level is picked block by block between
+   min_level and max_level to keep up with a target speed (see
+   lz4_set_target_speed and lz4_set_block_budget).  The context measures how
+   long recent blocks took at each level and how well they compressed, steps
+   down to a faster level when it is behind and up to a slower one when there
+   is time to spare and it compresses better.  Without a target every block
+   is compressed at max_level.  Blocks are independent and the frame is the
+   same as one written by lz4_init.  min_level is at least -32. */
+#ifdef _AML_DEBUG_
+#define lz4_init_adaptive(min_level, max_level, size, block_checksum,       \
+                          content_checksum)                                 \
+  _lz4_init_adaptive(min_level, max_level, size, block_checksum,            \
+                     content_checksum, aml_file_line_func("lz4_adaptive"))
+lz4_t *_lz4_init_adaptive(int min_level, int max_level,
+                          lz4_block_size_t size, bool block_checksum,
+                          bool content_checksum, const char *caller);
+#else
+#define lz4_init_adaptive(min_level, max_level, size, block_checksum,       \
+                          content_checksum)                                 \
+  _lz4_init_adaptive(min_level, max_level, size, block_checksum,            \
+                     content_checksum)
+lz4_t *_lz4_init_adaptive(int min_level, int max_level,
+                          lz4_block_size_t size, bool block_checksum,
+                          bool content_checksum);
+#endif
+
+/* the target of an adaptive context as MB/s (10^6 bytes of original data
+   per second) or as nanoseconds per full block.  0 removes the target. */
+void lz4_set_target_speed(lz4_t *l, double mb_s);
+void lz4_set_block_budget(lz4_t *l, uint64_t ns);
+
+/* the level the next block will be compressed at */
+int lz4_level(lz4_t *l);
+
 #ifdef _AML_DEBUG_
 #define lz4_init_decompress(header, header_size)                            \
   _lz4_init_decompress(header, header_size,                                 \
@@ -76,12 +199,86 @@ lz4_t *_lz4_init_decompress(void *header, uint32_t header_size);
 int lz4_decompress(lz4_t *l, const void *src, uint32_t src_len,
                       void *dest, uint32_t dest_len, bool compressed);
 
+/* Same as lz4_decompress, except that stored (uncompressed) blocks are not
+   copied to dest.  *data is set to the block data, which is in src for
+   stored blocks and in dest otherwise, and the length is returned.  The
+   content checksum is updated either way.  For readers which only look at the
+   data (hashing, forwarding, parsing), this saves a copy of every stored
+   block.  *data must not be used after src is released. */
+int lz4_decompress_view(lz4_t *l, const void *src, uint32_t src_len,
+                        void *dest, uint32_t dest_len, bool compressed,
+                        const void **data);
+
+/* Passes over a block the caller doesn't need, verifying its block checksum.
+   The block is still decompressed into dest (which must hold a full block)
+   if the frame has a content checksum or linked blocks, as the checksum and
+   the blocks after it depend on its data.  Returns false if the block is
+   invalid. */
+bool lz4_skip(lz4_t *l, const void *src, uint32_t src_len, void *dest,
+              uint32_t dest_len, bool compressed);
+
+/* Same as lz4_decompress, except that the content checksum is not updated and
+   l is not modified, so blocks of an independent frame can be decompressed
+   out of order and from several threads at once (see lz4_parallel.h).
+   Returns -1 for frames with linked blocks. */
+int lz4_decompress_independent(const lz4_t *l, const void *src,
+                               uint32_t src_len, void *dest,
+                               uint32_t dest_len, bool compressed);
+
 uint32_t lz4_compress(lz4_t *l, const void *src, uint32_t src_len,
                          void *dest, uint32_t dest_len);
 
+/* compresses src as one block (size word, data and block checksum) and
+   returns the bytes written to dest.  Blocks which don't compress are stored.
+   A sample of large blocks is checked first, blocks which look incompressible
+   (already compressed or encrypted data) are stored without compressing.
+   Blocks of linked frames and frames with a dictionary are always
+   compressed. */
 uint32_t lz4_compress_block(lz4_t *l, const void *src, uint32_t src_len,
                                void *dest, uint32_t dest_len);
 
+/* turns the incompressible check of lz4_compress_block on or off (it is on
+   by default) */
+void lz4_set_skip_incompressible(lz4_t *l, bool skip);
+
+/* Counters of a context, kept by lz4_compress_block and by lz4_decompress
+   and lz4_decompress_view (lz4_decompress_independent doesn't change the
+   context, so its blocks aren't counted). */
+typedef struct {
+  /* blocks compressed or decompressed */
+  uint64_t blocks;
+  /* blocks stored uncompressed */
+  uint64_t stored_blocks;
+  /* stored blocks which were not compressed as they looked incompressible */
+  uint64_t skipped_blocks;
+  /* original data passed in (compressing) or written (decompressing) */
+  uint64_t bytes;
+  /* size of the blocks written or read, with their size words and checksums
+     (bytes / compressed_bytes is the ratio) */
+  uint64_t compressed_bytes;
+  /* block and content checksums which didn't match */
+  uint64_t checksum_failures;
+  /* only counted when timing is enabled (lz4_enable_timing).  Time spent in
+     checksums is in checksum_ns and not in compress_ns / decompress_ns. */
+  uint64_t compress_ns;
+  uint64_t decompress_ns;
+  uint64_t checksum_ns;
+} lz4_stats_t;
+
+void lz4_get_stats(lz4_t *l, lz4_stats_t *stats);
+
+/* sets all of the counters to zero */
+void lz4_reset_stats(lz4_t *l);
+
+/* times every block (two to four clock reads per block), off by default */
+void lz4_enable_timing(lz4_t *l, bool enable);
+
+/* adds src to the content checksum without compressing it.  This is for
+   frames whose blocks are compressed by other contexts (see lz4_parallel.h).
+*/
+void lz4_update_content_checksum(lz4_t *l, const void *src,
+                                 uint32_t src_len);
+
 /* this will return a negative number if crc doesn't match.  dest should point
    to location for size if compressing and just after block_size if
    decompressing.  If result is non-negative, then it succeeded and read or
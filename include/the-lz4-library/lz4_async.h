@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_async_H
+#define _lz4_async_H
+
+#include "the-lz4-library/lz4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* File to file compression and decompression with asynchronous I/O.  A fixed
+   ring of queue_depth block buffers keeps reads in flight while blocks are
+   compressed (or decompressed), and each block is written as soon as it is
+   done, in order.  When the library is built with liburing (LZ4_IO_URING),
+   I/O goes through io_uring with the buffers registered; otherwise, or if the
+   kernel doesn't allow io_uring, a pool of threads runs pread and pwrite.
+
+   Both file descriptors must be regular files (reads and writes are
+   positioned, starting at offset 0).  queue_depth <= 0 uses 8. */
+
+/* true if the library was built with io_uring support and the kernel allows
+   creating a ring */
+bool lz4_async_uses_io_uring(void);
+
+/* compresses all of src_fd into dest_fd using l, which must not have
+   compressed anything yet.  The size of src_fd is written to the header as
+   the content size and the seek table is appended if it is enabled for l.
+   dest_fd is truncated to the frame.  Returns the size of the frame or -1 on
+   error. */
+int64_t lz4_async_compress(lz4_t *l, int src_fd, int dest_fd,
+                           int queue_depth);
+
+/* decompresses the frame at the start of src_fd into dest_fd, which is
+   truncated to the decompressed size.  Returns the decompressed size, -500 if
+   a checksum doesn't match or -1 if the frame is invalid or on an I/O
+   error. */
+int64_t lz4_async_decompress(int src_fd, int dest_fd, int queue_depth);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
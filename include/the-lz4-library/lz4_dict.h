@@ -0,0 +1,75 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_dict_H
+#define _lz4_dict_H
+
+#include "the-lz4-library/lz4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Dictionaries for compressing small records.  A dictionary is up to 64KB of
+   content which is typical of the records.  It is loaded once into fast and
+   HC compression states which are attached to the working state of each
+   compression, so using a dictionary costs little more than not using one.
+
+   A prepared dictionary is immutable and reference counted.  Any number of
+   contexts (in any number of threads) can share one, each lz4_t which uses it
+   holds a reference. */
+#define LZ4_DICT_MAX_SIZE (64 * 1024)
+
+struct lz4_dict_s;
+typedef struct lz4_dict_s lz4_dict_t;
+
+/* Builds a dictionary of at most dict_capacity bytes (up to
+   LZ4_DICT_MAX_SIZE) from num_samples sample records and appends it to dest.
+   Short substrings which occur in many samples are counted, and the segments
+   of the samples which contain the most of them are selected, with the most
+   valuable segments placed at the end of the dictionary (closest to the data).
+   Returns the size of the dictionary. */
+size_t lz4_dict_train(aml_buffer_t *dest, const void *const *samples,
+                      const size_t *sample_sizes, size_t num_samples,
+                      size_t dict_capacity);
+
+/* copies dict (only the last LZ4_DICT_MAX_SIZE bytes are used) and prepares
+   it for compression.  A dict_id of 0 derives the id from the content. */
+lz4_dict_t *lz4_dict_init(const void *dict, size_t dict_size,
+                          uint32_t dict_id);
+
+uint32_t lz4_dict_id(lz4_dict_t *d);
+
+const void *lz4_dict_data(lz4_dict_t *d, size_t *dict_size);
+
+/* adds a reference to d and returns it */
+lz4_dict_t *lz4_dict_retain(lz4_dict_t *d);
+
+/* drops a reference, d is freed when the last reference is dropped */
+void lz4_dict_release(lz4_dict_t *d);
+
+/* drops the reference returned by lz4_dict_init, same as lz4_dict_release */
+void lz4_dict_destroy(lz4_dict_t *d);
+
+/* Same as lz4_compress_appending_to_buffer and
+   lz4_decompress_into_fixed_buffer, using the dictionary */
+size_t lz4_compress_appending_to_buffer_with_dict(aml_buffer_t *dest,
+                                                  const void *src,
+                                                  int src_size, int level,
+                                                  lz4_dict_t *dict);
+bool lz4_decompress_into_fixed_buffer_with_dict(void *dest, int dest_size,
+                                                const void *src, int src_size,
+                                                lz4_dict_t *dict);
+
+/* Uses dict for the frame of l.  For compression, this must be called before
+   lz4_get_header (the dictionary id is written to the header).  For
+   decompression, the frame must have been compressed with a dictionary with
+   the same id.  l holds a reference to dict until it is destroyed or another
+   dictionary is set. */
+bool lz4_set_dictionary(lz4_t *l, lz4_dict_t *dict);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_file_H
+#define _lz4_file_H
+
+#include "the-lz4-library/lz4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Whole file compression and decompression over memory mappings.  The input
+   is mapped (with MADV_SEQUENTIAL and MADV_WILLNEED) and blocks are
+   compressed or decompressed straight from the mapping, so the input is never
+   copied into staging buffers.  Pages which have been consumed are released
+   as the file is processed, which keeps the resident size small for large
+   files. */
+
+/* compresses src_path into a frame written to dest_path (created or
+   truncated) using l, which must not have compressed anything yet.  The size
+   of the file is written to the header as the content size and the seek
+   table is appended if it is enabled for l.  Returns the size of the
+   compressed file or -1 on error. */
+int64_t lz4_compress_file(lz4_t *l, const char *src_path,
+                          const char *dest_path);
+
+/* decompresses the frame in src_path into dest_path (created or truncated).
+   If the frame has a content size, dest_path is sized up front and mapped,
+   and blocks are decompressed directly into the mapping.  Otherwise blocks
+   are decompressed into one block buffer and written.  Anything after the
+   frame (such as a seek table) is ignored.
+
+   Returns the size of the decompressed file, -500 if a checksum doesn't match
+   or -1 if the frame is invalid (or needs a dictionary) or on an I/O error.
+   dest_path is removed on error. */
+int64_t lz4_decompress_file(const char *src_path, const char *dest_path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
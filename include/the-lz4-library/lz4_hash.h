@@ -0,0 +1,79 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_hash_H
+#define _lz4_hash_H
+
+#include "the-lz4-library/lz4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* XXH3 hashes (xxHash 0.8).  These are much faster than lz4_hash64 (XXH64)
+   on both short keys and large inputs, but produce different values, so
+   lz4_hash64 is unchanged for hashes which are already stored somewhere.
+
+   Inputs over 240 bytes are hashed with SSE2 or, if the cpu supports it,
+   AVX2.  The kernel is selected once when the library is loaded and every
+   kernel produces the same values. */
+
+typedef struct {
+  uint64_t low;
+  uint64_t high;
+} lz4_hash128_t;
+
+uint64_t lz4_hash3_64(const void *s, size_t len, uint64_t seed);
+
+lz4_hash128_t lz4_hash3_128(const void *s, size_t len, uint64_t seed);
+
+/* name of the kernel used for large inputs ("avx2", "sse2", ...) */
+const char *lz4_hash3_kernel(void);
+
+/* Tree hash for large buffers, computed on num_threads threads (<= 0 uses
+   one per cpu).  The value is NOT the same as lz4_hash3_64 of the buffer.
+   It is defined as
+
+     n       = max(1, ceil(len / LZ4_HASH3_TREE_CHUNK_SIZE))
+     leaf[i] = lz4_hash3_128(chunk i, seed), written as the low then the high
+               64 bits, each little endian (16 bytes)
+     hash    = lz4_hash3_64(leaf[0] ... leaf[n-1] || len as 64 bits little
+               endian, seed)
+
+   so it doesn't depend on the number of threads and can be recomputed with
+   the single threaded functions. */
+#define LZ4_HASH3_TREE_CHUNK_SIZE (1024 * 1024)
+
+uint64_t lz4_hash3_tree(const void *s, size_t len, uint64_t seed,
+                        int num_threads);
+
+/* Streaming state, the digests of data passed in any number of updates are
+   the same as lz4_hash3_64 / lz4_hash3_128 of all of the data. */
+struct lz4_hash3_s;
+typedef struct lz4_hash3_s lz4_hash3_t;
+
+#ifdef _AML_DEBUG_
+#define lz4_hash3_init(seed)                                                \
+  _lz4_hash3_init(seed, aml_file_line_func("lz4_hash3"))
+lz4_hash3_t *_lz4_hash3_init(uint64_t seed, const char *caller);
+#else
+#define lz4_hash3_init(seed) _lz4_hash3_init(seed)
+lz4_hash3_t *_lz4_hash3_init(uint64_t seed);
+#endif
+
+/* starts over with a new seed */
+void lz4_hash3_reset(lz4_hash3_t *h, uint64_t seed);
+
+void lz4_hash3_update(lz4_hash3_t *h, const void *s, size_t len);
+
+/* the digests don't change the state, more data may be added after them */
+uint64_t lz4_hash3_digest64(lz4_hash3_t *h);
+lz4_hash128_t lz4_hash3_digest128(lz4_hash3_t *h);
+
+void lz4_hash3_destroy(lz4_hash3_t *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
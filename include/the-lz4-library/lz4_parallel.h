@@ -0,0 +1,78 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_parallel_H
+#define _lz4_parallel_H
+
+#include "the-lz4-library/lz4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Multi-threaded frame compression.  Blocks of a frame created by lz4_init
+   are independent, so each worker compresses whole blocks with its own lz4_t
+   while the calling thread updates the content checksum.  Blocks are appended
+   to the output in order and the frame is the same as compressing the input
+   one block at a time with lz4_compress_block. */
+struct lz4_parallel_s;
+typedef struct lz4_parallel_s lz4_parallel_t;
+
+/* num_threads <= 0 uses one worker per online cpu */
+#ifdef _AML_DEBUG_
+#define lz4_parallel_init(level, size, block_checksum, content_checksum,    \
+                          num_threads)                                      \
+  _lz4_parallel_init(level, size, block_checksum, content_checksum,         \
+                     num_threads, aml_file_line_func("lz4_parallel"))
+lz4_parallel_t *_lz4_parallel_init(int level, lz4_block_size_t size,
+                                   bool block_checksum, bool content_checksum,
+                                   int num_threads, const char *caller);
+#else
+#define lz4_parallel_init(level, size, block_checksum, content_checksum,    \
+                          num_threads)                                      \
+  _lz4_parallel_init(level, size, block_checksum, content_checksum,         \
+                     num_threads)
+lz4_parallel_t *_lz4_parallel_init(int level, lz4_block_size_t size,
+                                   bool block_checksum, bool content_checksum,
+                                   int num_threads);
+#endif
+
+/* appends the frame header (on the first call) and the compressed blocks of
+   src to dest.  Up to two blocks per worker are still being compressed when
+   this returns, their input is copied (as is a trailing partial block), so
+   src may be reused on return.  They are appended by later writes or by
+   lz4_parallel_finish. */
+void lz4_parallel_write(lz4_parallel_t *p, aml_buffer_t *dest,
+                        const void *src, size_t src_len);
+
+/* appends the last block, the end mark and the content checksum to dest.
+   The next write starts a new frame. */
+void lz4_parallel_finish(lz4_parallel_t *p, aml_buffer_t *dest);
+
+/* appends a complete frame for src to dest and returns its length */
+size_t lz4_parallel_compress(lz4_parallel_t *p, aml_buffer_t *dest,
+                             const void *src, size_t src_len);
+
+int lz4_parallel_threads(lz4_parallel_t *p);
+
+void lz4_parallel_destroy(lz4_parallel_t *p);
+
+/* Decompresses the frame in src and appends it to dest using num_threads
+   workers (<= 0 for one per online cpu).  The block headers are scanned
+   first, then each block is decompressed directly into its offset in dest and
+   its block checksum is verified by the worker.  The content checksum is
+   updated in order by the calling thread as blocks complete.  Every block but
+   the last must decompress to the full block size, as lz4_compress_block and
+   the lz4 tools produce.  Frames with linked blocks are rejected.
+
+   Returns the number of bytes appended, -500 if a checksum doesn't match or
+   another negative value if the frame is invalid.  dest is left unchanged on
+   error. */
+int64_t lz4_parallel_decompress(aml_buffer_t *dest, const void *src,
+                                size_t src_len, int num_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_reader_H
+#define _lz4_reader_H
+
+#include "the-lz4-library/lz4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sequential reader over a frame in a file descriptor or in memory.  The
+   header and block sizes are parsed internally.  A helper thread reads the
+   next block (and decompresses it when reads are small) ahead of the caller.
+   Reads which cover a whole block decompress it directly into the caller's
+   buffer.  Block checksums and the content checksum are verified.
+
+   Reading stops at the end of the first frame. */
+struct lz4_reader_s;
+typedef struct lz4_reader_s lz4_reader_t;
+
+/* returns NULL if the frame header is invalid */
+#ifdef _AML_DEBUG_
+#define lz4_reader_init(fd)                                                 \
+  _lz4_reader_init(fd, NULL, 0, aml_file_line_func("lz4_reader"))
+#define lz4_reader_init_memory(src, src_len)                                \
+  _lz4_reader_init(-1, src, src_len, aml_file_line_func("lz4_reader"))
+lz4_reader_t *_lz4_reader_init(int fd, const void *src, size_t src_len,
+                               const char *caller);
+#else
+#define lz4_reader_init(fd) _lz4_reader_init(fd, NULL, 0)
+#define lz4_reader_init_memory(src, src_len)                                \
+  _lz4_reader_init(-1, src, src_len)
+lz4_reader_t *_lz4_reader_init(int fd, const void *src, size_t src_len);
+#endif
+
+/* header of the frame being read */
+const lz4_header_t *lz4_reader_header(lz4_reader_t *r);
+
+/* reads up to len bytes into dest.  Returns the number of bytes read, which
+   is less than len only at the end of the frame, -500 if a checksum doesn't
+   match or -1 if the frame is invalid or truncated.  Errors are reported once
+   the data before them has been read and are sticky. */
+int64_t lz4_reader_read(lz4_reader_t *r, void *dest, size_t len);
+
+void lz4_reader_destroy(lz4_reader_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_seekable_H
+#define _lz4_seekable_H
+
+#include "the-lz4-library/lz4.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Seekable frames.  A seek table is an LZ4 skippable frame written after the
+   end of a frame (after lz4_finish).  Tools which don't know about it skip
+   it, so the file is still a valid .lz4 file.
+
+     uint32_t magic                 LZ4_SEEK_TABLE_FRAME_MAGIC
+     uint32_t frame size            (8 * num_blocks + 8)
+     num_blocks times:
+       uint32_t compressed size     bytes the block occupies in the frame,
+                                    including its size word and checksum
+       uint32_t decompressed size
+     uint32_t num_blocks
+     uint32_t magic                 LZ4_SEEK_TABLE_MAGIC
+
+   All values are little endian.  The footer is at the very end so that a
+   reader can find the table from the end of the file. */
+#define LZ4_SEEK_TABLE_FRAME_MAGIC 0x184D2A5EU
+#define LZ4_SEEK_TABLE_MAGIC 0x4B455334U
+
+/* records the size of every block l compresses, must be called before the
+   first call to lz4_compress_block */
+void lz4_enable_seek_table(lz4_t *l);
+
+/* appends the seek table to dest (after lz4_finish) and returns the number of
+   bytes appended, 0 if the seek table was not enabled */
+size_t lz4_write_seek_table(lz4_t *l, aml_buffer_t *dest);
+
+/* Random access reader over a seekable frame which starts at offset 0 of a
+   file or a memory region.  Only the blocks covering a read are decompressed.
+   The content checksum can't be verified by a random access reader, block
+   checksums are verified.  Frames with linked blocks are not supported. */
+struct lz4_seekable_s;
+typedef struct lz4_seekable_s lz4_seekable_t;
+
+/* returns NULL if src doesn't end with a valid seek table */
+lz4_seekable_t *lz4_seekable_init(const void *src, size_t src_len);
+
+/* the fd is not closed by lz4_seekable_destroy */
+lz4_seekable_t *lz4_seekable_open(int fd);
+
+/* total decompressed size */
+uint64_t lz4_seekable_size(lz4_seekable_t *r);
+
+uint32_t lz4_seekable_num_blocks(lz4_seekable_t *r);
+
+/* reads up to len bytes of decompressed data starting at offset (like
+   pread).  Returns the number of bytes read, which is less than len only at
+   the end of the data, or a negative value on error. */
+int64_t lz4_seekable_read(lz4_seekable_t *r, void *dest, size_t len,
+                          uint64_t offset);
+
+void lz4_seekable_destroy(lz4_seekable_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_writer_H
+#define _lz4_writer_H
+
+#include "the-lz4-library/lz4.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Writes a frame to a file descriptor or FILE *.  Writes of any size are
+   copied into one of two block buffers.  When a buffer is full, it is handed
+   to a background thread which compresses it and writes it out while the
+   other buffer fills, so compression and I/O overlap with the caller.
+
+   The frame is compressed with l (see lz4_init, lz4_init_linked,
+   lz4_set_content_size, lz4_set_dictionary and lz4_enable_seek_table), which
+   must not be used otherwise until the writer is closed.  l is not destroyed
+   by the writer. */
+struct lz4_writer_s;
+typedef struct lz4_writer_s lz4_writer_t;
+
+#ifdef _AML_DEBUG_
+#define lz4_writer_init(fd, l)                                              \
+  _lz4_writer_init(fd, NULL, l, aml_file_line_func("lz4_writer"))
+#define lz4_writer_init_file(file, l)                                       \
+  _lz4_writer_init(-1, file, l, aml_file_line_func("lz4_writer"))
+lz4_writer_t *_lz4_writer_init(int fd, FILE *file, lz4_t *l,
+                               const char *caller);
+#else
+#define lz4_writer_init(fd, l) _lz4_writer_init(fd, NULL, l)
+#define lz4_writer_init_file(file, l) _lz4_writer_init(-1, file, l)
+lz4_writer_t *_lz4_writer_init(int fd, FILE *file, lz4_t *l);
+#endif
+
+/* copies src into the frame.  Returns false if an earlier write to the
+   output failed (the error is sticky). */
+bool lz4_writer_write(lz4_writer_t *w, const void *src, size_t src_len);
+
+/* compresses and writes the last block, the end mark, the content checksum
+   and the seek table (if enabled), then frees w.  The fd or FILE * is
+   flushed but not closed.  Returns false if any write failed. */
+bool lz4_writer_close(lz4_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -120,6 +120,12 @@
 #  pragma warning(disable : 4293)        /* disable: C4293: too large shift (32-bits) */
 #endif  /* _MSC_VER */
 
+/* LZ4_AVX2_KERNELS : set when this file is compiled (a second time) for
+ * cpus with AVX2 and BMI2, see lz4_avx2.c */
+#ifdef LZ4_AVX2_KERNELS
+#  include <immintrin.h>
+#endif
+
 #ifndef LZ4_FORCE_INLINE
 #  ifdef _MSC_VER    /* Visual Studio */
 #    define LZ4_FORCE_INLINE static __forceinline
@@ -429,6 +435,26 @@ LZ4_wildCopy32(void* dstPtr, const void* srcPtr, void* dstEnd)
     do { memcpy(d,s,16); memcpy(d+16,s+16,16); d+=32; s+=32; } while (d<e);
 }
 
+/* copies whole 32 byte stripes, so it may only be used when the source and
+ * the destination are at least 32 bytes apart (literals, or a match with an
+ * offset of 32 or more) */
+LZ4_FORCE_O2_INLINE_GCC_PPC64LE void
+LZ4_stripeCopy32(void* dstPtr, const void* srcPtr, void* dstEnd)
+{
+#ifdef LZ4_AVX2_KERNELS
+    BYTE* d = (BYTE*)dstPtr;
+    const BYTE* s = (const BYTE*)srcPtr;
+    BYTE* const e = (BYTE*)dstEnd;
+
+    do {
+        _mm256_storeu_si256((__m256i*)d, _mm256_loadu_si256((const __m256i*)s));
+        d+=32; s+=32;
+    } while (d<e);
+#else
+    LZ4_wildCopy32(dstPtr, srcPtr, dstEnd);
+#endif
+}
+
 /* LZ4_memcpy_using_offset()  presumes :
  * - dstEnd >= dstPtr + MINMATCH
  * - there is at least 8 bytes available to write after dstEnd */
@@ -556,6 +582,18 @@ unsigned LZ4_count(const BYTE* pIn, const BYTE* pMatch, const BYTE* pInLimit)
             return LZ4_NbCommonBytes(diff);
     }   }
 
+#ifdef LZ4_AVX2_KERNELS
+    /* long matches are compared 32 bytes at a time */
+    while (likely(pIn < pInLimit-31)) {
+        __m256i const eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)pIn),
+                                             _mm256_loadu_si256((const __m256i*)pMatch));
+        U32 const diff = ~(U32)_mm256_movemask_epi8(eq);
+        if (!diff) { pIn+=32; pMatch+=32; continue; }
+        pIn += _tzcnt_u32(diff);
+        return (unsigned)(pIn - pStart);
+    }
+#endif
+
     while (likely(pIn < pInLimit-(STEPSIZE-1))) {
         reg_t const diff = LZ4_read_ARCH(pMatch) ^ LZ4_read_ARCH(pIn);
         if (!diff) { pIn+=STEPSIZE; pMatch+=STEPSIZE; continue; }
@@ -1742,7 +1780,7 @@ LZ4_decompress_generic(
                 LZ4_STATIC_ASSERT(MFLIMIT >= WILDCOPYLENGTH);
                 if (endOnInput) {  /* LZ4_decompress_safe() */
                     if ((cpy>oend-32) || (ip+length>iend-32)) { goto safe_literal_copy; }
-                    LZ4_wildCopy32(op, ip, cpy);
+                    LZ4_stripeCopy32(op, ip, cpy);
                 } else {   /* LZ4_decompress_fast() */
                     if (cpy>oend-8) { goto safe_literal_copy; }
                     LZ4_wildCopy8(op, ip, cpy); /* LZ4_decompress_fast() cannot copy more than 8 bytes at a time :
@@ -1841,6 +1879,10 @@ LZ4_decompress_generic(
             assert((op <= oend) && (oend-op >= 32));
             if (unlikely(offset<16)) {
                 LZ4_memcpy_using_offset(op, match, cpy, offset);
+#ifdef LZ4_AVX2_KERNELS
+            } else if (offset>=32) {
+                LZ4_stripeCopy32(op, match, cpy);
+#endif
             } else {
                 LZ4_wildCopy32(op, match, cpy);
             }
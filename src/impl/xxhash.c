@@ -277,6 +277,12 @@ static U32 XXH32_round(U32 seed, U32 input)
     seed += input * PRIME32_2;
     seed  = XXH_rotl32(seed, 13);
     seed *= PRIME32_1;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(XXH_ENABLE_AUTOVECTORIZE)
+    /* Keeps gcc from vectorizing the four lanes (as in later xxHash releases).
+     * Without SSE4.1 the 32-bit multiplies are emulated, which halves the
+     * speed of XXH32_update(). */
+    __asm__("" : "+r" (seed));
+#endif
     return seed;
 }
 
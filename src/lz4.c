@@ -2,46 +2,185 @@
 // SPDX-FileCopyrightText: 2024-2025 Knode.ai
 // SPDX-License-Identifier: Apache-2.0
 #include "the-lz4-library/lz4.h"
+#include "the-lz4-library/lz4_dict.h"
+#include "the-lz4-library/lz4_seekable.h"
 
+/* builds which already target AVX2 use its copies in the baseline build (and
+   lz4_avx2.c is empty) */
+#if defined(__AVX2__) && defined(__BMI__)
+#define LZ4_AVX2_KERNELS
+#endif
 #include "impl/lz4.c"
 #include "impl/lz4hc.c"
 #include "impl/xxhash.c"
 
+#include "lz4_kernels.h"
+
 #include "a-memory-library/aml_alloc.h"
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 uint64_t lz4_hash64(const void *s, size_t len) {
   return (uint64_t)XXH64(s, len, 0);
 }
 
+/* XXH64 with a seed of 0, inlined into the batch loops.  The key length is
+   a constant when called from lz4_hash64_batch_fixed, so the loops over the
+   words of the key unroll completely. */
+LZ4_FORCE_INLINE uint64_t hash64_key(const unsigned char *p, size_t len) {
+  XXH_endianess endian = (XXH_endianess)XXH_CPU_LITTLE_ENDIAN;
+  const unsigned char *end = p + len;
+  U64 h64;
+  if (len >= 32) {
+    U64 v1 = PRIME64_1 + PRIME64_2;
+    U64 v2 = PRIME64_2;
+    U64 v3 = 0;
+    U64 v4 = -PRIME64_1;
+    do {
+      v1 = XXH64_round(v1, XXH_readLE64(p, endian));
+      v2 = XXH64_round(v2, XXH_readLE64(p + 8, endian));
+      v3 = XXH64_round(v3, XXH_readLE64(p + 16, endian));
+      v4 = XXH64_round(v4, XXH_readLE64(p + 24, endian));
+      p += 32;
+    } while (p <= end - 32);
+    h64 = XXH_rotl64(v1, 1) + XXH_rotl64(v2, 7) + XXH_rotl64(v3, 12) +
+          XXH_rotl64(v4, 18);
+    h64 = XXH64_mergeRound(h64, v1);
+    h64 = XXH64_mergeRound(h64, v2);
+    h64 = XXH64_mergeRound(h64, v3);
+    h64 = XXH64_mergeRound(h64, v4);
+  } else
+    h64 = PRIME64_5;
+  h64 += (U64)len;
+  for (size_t i = len & 31; i >= 8; i -= 8) {
+    h64 ^= XXH64_round(0, XXH_readLE64(p, endian));
+    h64 = XXH_rotl64(h64, 27) * PRIME64_1 + PRIME64_4;
+    p += 8;
+  }
+  if (len & 4) {
+    h64 ^= (U64)XXH_readLE32(p, endian) * PRIME64_1;
+    h64 = XXH_rotl64(h64, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+  for (size_t i = len & 3; i > 0; i--) {
+    h64 ^= (*p++) * PRIME64_5;
+    h64 = XXH_rotl64(h64, 11) * PRIME64_1;
+  }
+  return XXH64_avalanche(h64);
+}
+
+void lz4_hash64_batch(const void *const *keys, const size_t *lens,
+                      uint64_t *out, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = hash64_key((const unsigned char *)keys[i], lens[i]);
+}
+
+LZ4_FORCE_INLINE void hash64_fixed(const unsigned char *keys, size_t key_len,
+                                   uint64_t *out, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const unsigned char *p = keys + i * key_len;
+    uint64_t h0 = hash64_key(p, key_len);
+    uint64_t h1 = hash64_key(p + key_len, key_len);
+    uint64_t h2 = hash64_key(p + 2 * key_len, key_len);
+    uint64_t h3 = hash64_key(p + 3 * key_len, key_len);
+    out[i] = h0;
+    out[i + 1] = h1;
+    out[i + 2] = h2;
+    out[i + 3] = h3;
+  }
+  for (; i < n; i++)
+    out[i] = hash64_key(keys + i * key_len, key_len);
+}
+
+void lz4_hash64_batch_fixed(const void *keys, size_t key_len, uint64_t *out,
+                            size_t n) {
+  const unsigned char *p = (const unsigned char *)keys;
+  /* common key sizes get a copy of the loop with the length constant */
+  switch (key_len) {
+  case 4:
+    hash64_fixed(p, 4, out, n);
+    break;
+  case 8:
+    hash64_fixed(p, 8, out, n);
+    break;
+  case 12:
+    hash64_fixed(p, 12, out, n);
+    break;
+  case 16:
+    hash64_fixed(p, 16, out, n);
+    break;
+  case 24:
+    hash64_fixed(p, 24, out, n);
+    break;
+  case 32:
+    hash64_fixed(p, 32, out, n);
+    break;
+  case 64:
+    hash64_fixed(p, 64, out, n);
+    break;
+  default:
+    hash64_fixed(p, key_len, out, n);
+    break;
+  }
+}
+
 int lz4_compress_bound(int inputSize) {
     return LZ4_compressBound(inputSize);
 }
 
+static const lz4_kernels_t baseline_kernels = {
+    LZ4_decompress_safe,
+    LZ4_decompress_safe_usingDict,
+    LZ4_decompress_safe_continue,
+    LZ4_compress_fast_extState_fastReset,
+    LZ4_compress_fast_continue,
+    LZ4_compress_HC_extStateHC_fastReset,
+    LZ4_compress_HC_continue,
+    "baseline"};
+
+static lz4_kernels_t kernels = baseline_kernels;
+
+#if (defined(__x86_64__) || defined(_M_X64)) && defined(__GNUC__)
+/* runs before main (and before any other thread could compress) */
+__attribute__((constructor)) static void select_kernels(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") &&
+      __builtin_cpu_supports("bmi2"))
+    lz4_set_kernels("avx2");
+}
+#endif
+
+const char *lz4_kernels(void) { return kernels.name; }
 
-static uint8_t _64kb[7] = {0x04, 0x22, 0x4d, 0x18, 0x60, 0x40, 0x82};
-static uint8_t c_64kb[7] = {0x04, 0x22, 0x4d, 0x18, 0x64, 0x40, 0xa7};
-static uint8_t b_64kb[7] = {0x04, 0x22, 0x4d, 0x18, 0x70, 0x40, 0xad};
-static uint8_t cb_64kb[7] = {0x04, 0x22, 0x4d, 0x18, 0x74, 0x40, 0xbd};
+bool lz4_set_kernels(const char *name) {
+  const lz4_kernels_t *k = NULL;
+  if (!strcmp(name, baseline_kernels.name))
+    k = &baseline_kernels;
+  else if (!strcmp(name, "avx2"))
+    k = lz4_avx2_kernels();
+  if (!k)
+    return false;
+  kernels = *k;
+  return true;
+}
 
-static uint8_t _256kb[7] = {0x04, 0x22, 0x4d, 0x18, 0x60, 0x50, 0xfb};
-static uint8_t c_256kb[7] = {0x04, 0x22, 0x4d, 0x18, 0x64, 0x50, 0x08};
-static uint8_t b_256kb[7] = {0x04, 0x22, 0x4d, 0x18, 0x70, 0x50, 0x84};
-static uint8_t cb_256kb[7] = {0x04, 0x22, 0x4d, 0x18, 0x74, 0x50, 0xff};
 
-static uint8_t _1mb[7] = {0x04, 0x22, 0x4d, 0x18, 0x60, 0x60, 0x51};
-static uint8_t c_1mb[7] = {0x04, 0x22, 0x4d, 0x18, 0x64, 0x60, 0x85};
-static uint8_t b_1mb[7] = {0x04, 0x22, 0x4d, 0x18, 0x70, 0x60, 0x33};
-static uint8_t cb_1mb[7] = {0x04, 0x22, 0x4d, 0x18, 0x74, 0x60, 0xd9};
+#define LZ4_FRAME_MAGIC 0x184D2204U
 
-static uint8_t _4mb[7] = {0x04, 0x22, 0x4d, 0x18, 0x60, 0x70, 0x73};
-static uint8_t c_4mb[7] = {0x04, 0x22, 0x4d, 0x18, 0x64, 0x70, 0xb9};
-static uint8_t b_4mb[7] = {0x04, 0x22, 0x4d, 0x18, 0x70, 0x70, 0x72};
-static uint8_t cb_4mb[7] = {0x04, 0x22, 0x4d, 0x18, 0x74, 0x70, 0x8e};
+/* FLG byte of the frame descriptor */
+#define LZ4_FLG_VERSION 0x40
+#define LZ4_FLG_BLOCK_INDEPENDENCE 0x20
+#define LZ4_FLG_BLOCK_CHECKSUM 0x10
+#define LZ4_FLG_CONTENT_SIZE 0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_DICT_ID 0x01
 
 struct lz4_s {
   lz4_block_size_t size;
@@ -57,8 +196,68 @@ struct lz4_s {
   uint32_t block_header_size;
   XXH32_state_t xxh;
   void *ctx;
+
+  /* linked blocks keep the last 64KB of history in dict */
+  bool linked;
+  char *dict;
+  uint32_t dict_size;
+  LZ4_streamDecode_t *dctx;
+  uint8_t header_buf[LZ4_MAX_HEADER_SIZE];
+
+  bool has_content_size;
+  uint64_t content_size;
+  uint32_t dict_id;
+  lz4_dict_t *dictionary;
+  lz4_stats_t stats;
+  bool timing;
+  /* lz4_compress_block stores blocks which look incompressible */
+  bool skip_incompressible;
+  /* level controller (lz4_init_adaptive) */
+  struct lz4_adaptive_s *adaptive;
+
+  /* compressed and decompressed size of each block when seekable */
+  aml_buffer_t *seek_table;
+};
+
+#define LZ4_LINKED_DICT_SIZE (64 * 1024)
+
+/* the dictionary is loaded once into both kinds of state, compression
+   attaches them (dictCtx) to its working state.  Attached states are only
+   read, so any number of threads can share a dictionary. */
+struct lz4_dict_s {
+  atomic_int refs;
+  uint32_t id;
+  uint32_t size;
+  LZ4_streamHC_t *hc;
+  LZ4_stream_t *fast;
+  char *data;
 };
 
+static uint64_t lz4_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint8_t lz4_descriptor_checksum(const uint8_t *desc, size_t len) {
+  return (uint8_t)(XXH32(desc, len, 0) >> 8);
+}
+
+static void lz4_update_dict(lz4_t *l, const void *src, uint32_t len) {
+  const char *srcp = (const char *)src;
+  if (len >= LZ4_LINKED_DICT_SIZE) {
+    memcpy(l->dict, srcp + len - LZ4_LINKED_DICT_SIZE, LZ4_LINKED_DICT_SIZE);
+    l->dict_size = LZ4_LINKED_DICT_SIZE;
+    return;
+  }
+  uint32_t keep = l->dict_size;
+  if (keep + len > LZ4_LINKED_DICT_SIZE)
+    keep = LZ4_LINKED_DICT_SIZE - len;
+  memmove(l->dict, l->dict + l->dict_size - keep, keep);
+  memcpy(l->dict + keep, srcp, len);
+  l->dict_size = keep + len;
+}
+
 const char *lz4_get_header(lz4_t *r, uint32_t *length) {
   *length = r->header_size;
   return (const char *)r->header;
@@ -72,35 +271,93 @@ uint32_t lz4_compressed_size(lz4_t *r) {
   return r->compressed_size + r->block_header_size;
 }
 
+/* memcpy as dest and src are often unaligned (dictionary ids in the header,
+   seek table entries, block checksums) */
 static void write_little_endian_32(char *dest, uint32_t v) {
-  (*(uint32_t *)(dest)) = v;
+  memcpy(dest, &v, sizeof(v));
 }
 
-static uint32_t read_little_endian_32(char *dest) {
-  return (*(uint32_t *)(dest));
+static void write_little_endian_64(char *dest, uint64_t v) {
+  memcpy(dest, &v, sizeof(v));
+}
+
+static uint64_t read_little_endian_64(const char *src) {
+  uint64_t v;
+  memcpy(&v, src, sizeof(v));
+  return v;
+}
+
+static uint32_t read_little_endian_32(const char *src) {
+  uint32_t v;
+  memcpy(&v, src, sizeof(v));
+  return v;
 }
 
 uint32_t lz4_compress(lz4_t *l, const void *src, uint32_t src_len,
                          void *dest, uint32_t dest_len) {
   int level = l->level;
   void *ctx = l->ctx;
+  if (l->linked) {
+    /* the stream carries history from the previous block, saveDict moves it
+       out of the caller's buffer so that src can be reused */
+    int r;
+    if (level < LZ4HC_CLEVEL_MIN) {
+      int const acceleration = (level < 0) ? -level + 1 : 1;
+      r = kernels.compress_fast_continue((LZ4_stream_t *)ctx,
+                                         (const char *)src, (char *)dest,
+                                         src_len, dest_len, acceleration);
+      LZ4_saveDict((LZ4_stream_t *)ctx, l->dict, LZ4_LINKED_DICT_SIZE);
+    } else {
+      r = kernels.compress_hc_continue((LZ4_streamHC_t *)ctx,
+                                       (const char *)src, (char *)dest,
+                                       src_len, dest_len);
+      LZ4_saveDictHC((LZ4_streamHC_t *)ctx, l->dict, LZ4_LINKED_DICT_SIZE);
+    }
+    return r;
+  }
+  if (l->dictionary) {
+    /* the *_fastReset functions would detach the dictionary */
+    if (level < LZ4HC_CLEVEL_MIN) {
+      int const acceleration = (level < 0) ? -level + 1 : 1;
+      LZ4_resetStream_fast((LZ4_stream_t *)ctx);
+      LZ4_attach_dictionary((LZ4_stream_t *)ctx, l->dictionary->fast);
+      return kernels.compress_fast_continue((LZ4_stream_t *)ctx,
+                                            (const char *)src, (char *)dest,
+                                            src_len, dest_len, acceleration);
+    }
+    LZ4_resetStreamHC_fast((LZ4_streamHC_t *)ctx, level);
+    LZ4_attach_HC_dictionary((LZ4_streamHC_t *)ctx, l->dictionary->hc);
+    return kernels.compress_hc_continue((LZ4_streamHC_t *)ctx,
+                                        (const char *)src, (char *)dest,
+                                        src_len, dest_len);
+  }
   if (level < LZ4HC_CLEVEL_MIN) {
     /* this does a bit more than just attaching dictionary (needed?) */
     LZ4_attach_dictionary((LZ4_stream_t *)ctx, NULL);
     int const acceleration = (level < 0) ? -level + 1 : 1;
 
-    return LZ4_compress_fast_extState_fastReset(
+    return kernels.compress_fast_ext_state_fast_reset(
         (LZ4_stream_t *)ctx, (const char *)src, (char *)dest, src_len, dest_len,
         acceleration);
   } else {
     LZ4_resetStreamHC_fast((LZ4_streamHC_t *)ctx, level);
     /* this does a bit more than just attaching dictionary (needed?) */
     LZ4_attach_HC_dictionary((LZ4_streamHC_t *)ctx, NULL);
-    return LZ4_compress_HC_extStateHC_fastReset(
+    return kernels.compress_hc_ext_state_fast_reset(
         ctx, (const char *)src, (char *)dest, src_len, dest_len, level);
   }
 }
 
+void lz4_update_content_checksum(lz4_t *l, const void *src,
+                                 uint32_t src_len) {
+  if (!l->content_checksum)
+    return;
+  uint64_t start = l->timing ? lz4_now_ns() : 0;
+  (void)XXH32_update(&l->xxh, src, src_len);
+  if (l->timing)
+    l->stats.checksum_ns += lz4_now_ns() - start;
+}
+
 int lz4_finish(lz4_t *l, void *dest) {
   char *destp = (char *)dest;
   if (l->ctx) {
@@ -116,192 +373,467 @@ int lz4_finish(lz4_t *l, void *dest) {
     if (l->content_checksum) {
       uint32_t crc = XXH32_digest(&(l->xxh));
       uint32_t content_crc = read_little_endian_32(destp);
-      if (crc != content_crc)
+      if (crc != content_crc) {
+        l->stats.checksum_failures++;
         return -500;
+      }
     }
     return 0;
   }
 }
 
-/*
-   make sure that the block checksum matches if desired.
-   If this is being used for seeking, you should assume that
-   the last block can be less than dest_len decompressed.
-*/
-bool lz4_skip(lz4_t *l, const void *src, uint32_t src_len, void *dest,
-                 uint32_t dest_len, bool compressed) {
+static int lz4_check_block(const lz4_t *l, const void *src,
+                           uint32_t src_len) {
   if (l->block_checksum) {
     char *srcp = (char *)src;
+    if (src_len < 4)
+      return -1;
     uint32_t checksum = read_little_endian_32(srcp + src_len - 4);
     uint32_t crc32 = XXH32(src, src_len - 4, 0);
     if (crc32 != checksum)
-      return false;
+      return -500;
     src_len -= 4;
   }
-  if (l->content_checksum) {
-    int r =
-        LZ4_decompress_safe((const char *)src, (char *)dest, src_len, dest_len);
-    if (r < 0)
-      return false;
-    if (l->content_checksum)
-      (void)XXH32_update(&l->xxh, dest, r);
+  return src_len;
+}
+
+int lz4_decompress_independent(const lz4_t *l, const void *src,
+                               uint32_t src_len, void *dest,
+                               uint32_t dest_len, bool compressed) {
+  if (l->linked)
+    return -1;
+  int r = lz4_check_block(l, src, src_len);
+  if (r < 0)
+    return r;
+  src_len = r;
+  if (compressed) {
+    if (l->dict_id) {
+      if (!l->dictionary)
+        return -1;
+      return kernels.decompress_safe_using_dict(
+          (const char *)src, (char *)dest, src_len, dest_len,
+          l->dictionary->data, l->dictionary->size);
+    }
+    return kernels.decompress_safe((const char *)src, (char *)dest, src_len,
+                                   dest_len);
   }
-  return true;
+  if (src_len > dest_len)
+    return -1;
+  memcpy(dest, src, src_len);
+  return src_len;
 }
 
-int lz4_decompress(lz4_t *l, const void *src, uint32_t src_len,
-                      void *dest, uint32_t dest_len, bool compressed) {
-  if (l->block_checksum) {
-    char *srcp = (char *)src;
-    uint32_t checksum = read_little_endian_32(srcp + src_len - 4);
-    uint32_t crc32 = XXH32(src, src_len - 4, 0);
-    if (crc32 != checksum)
-      return -500;
-    src_len -= 4;
+/* stored blocks are copied to dest if copy is set, otherwise *data points to
+   them in src */
+static int lz4_decode_block(lz4_t *l, const void *src, uint32_t src_len,
+                            void *dest, uint32_t dest_len, bool compressed,
+                            bool copy, const void **data) {
+  uint64_t start = l->timing ? lz4_now_ns() : 0, checked = start;
+  uint32_t block_len = src_len + sizeof(uint32_t);
+  int r = lz4_check_block(l, src, src_len);
+  if (r < 0) {
+    if (r == -500)
+      l->stats.checksum_failures++;
+    return r;
   }
+  src_len = r;
+  if (l->dict_id && !l->dictionary)
+    return -1;
+  if (l->timing && l->block_checksum)
+    checked = lz4_now_ns();
 
-  int r = src_len;
-  if (compressed)
-    r = LZ4_decompress_safe((const char *)src, (char *)dest, src_len, dest_len);
-  else
+  *data = dest;
+  if (compressed) {
+    if (!l->linked && l->dictionary)
+      r = kernels.decompress_safe_using_dict(
+          (const char *)src, (char *)dest, src_len, dest_len,
+          l->dictionary->data, l->dictionary->size);
+    else if (l->linked) {
+      LZ4_setStreamDecode(l->dctx, l->dict, l->dict_size);
+      r = kernels.decompress_safe_continue(l->dctx, (const char *)src,
+                                           (char *)dest, src_len, dest_len);
+    } else
+      r = kernels.decompress_safe((const char *)src, (char *)dest, src_len,
+                                  dest_len);
+  } else if (copy) {
+    if (src_len > dest_len)
+      return -1;
     memcpy(dest, src, src_len);
+  } else
+    *data = src;
   if (r < 0)
     return r;
+  if (l->linked)
+    lz4_update_dict(l, (const char *)*data, r);
+  uint64_t decoded = l->timing ? lz4_now_ns() : 0;
   if (l->content_checksum)
-    (void)XXH32_update(&l->xxh, dest, r);
+    (void)XXH32_update(&l->xxh, *data, r);
+
+  l->stats.blocks++;
+  if (!compressed)
+    l->stats.stored_blocks++;
+  l->stats.bytes += r;
+  l->stats.compressed_bytes += block_len;
+  if (l->timing) {
+    uint64_t end = l->content_checksum ? lz4_now_ns() : decoded;
+    l->stats.decompress_ns += decoded - checked;
+    l->stats.checksum_ns += (checked - start) + (end - decoded);
+  }
   return r;
 }
 
+int lz4_decompress(lz4_t *l, const void *src, uint32_t src_len,
+                      void *dest, uint32_t dest_len, bool compressed) {
+  const void *data;
+  return lz4_decode_block(l, src, src_len, dest, dest_len, compressed, true,
+                          &data);
+}
+
+int lz4_decompress_view(lz4_t *l, const void *src, uint32_t src_len,
+                        void *dest, uint32_t dest_len, bool compressed,
+                        const void **data) {
+  return lz4_decode_block(l, src, src_len, dest, dest_len, compressed, false,
+                          data);
+}
+
+/*
+   make sure that the block checksum matches if desired.
+   If this is being used for seeking, you should assume that
+   the last block can be less than dest_len decompressed.
+*/
+bool lz4_skip(lz4_t *l, const void *src, uint32_t src_len, void *dest,
+              uint32_t dest_len, bool compressed) {
+  /* the content checksum and the history of linked blocks need the data */
+  if (l->content_checksum || l->linked) {
+    const void *data;
+    return lz4_decode_block(l, src, src_len, dest, dest_len, compressed,
+                            false, &data) >= 0;
+  }
+  int r = lz4_check_block(l, src, src_len);
+  if (r == -500)
+    l->stats.checksum_failures++;
+  return r >= 0;
+}
+
+/* Blocks of already compressed data (images, gzip, encrypted payloads) would
+   go through a full compression pass only to be stored.  LZ4 only gains from
+   repeated sequences, so samples of the block are checked for 4-byte repeats
+   and for an almost uniform byte distribution before compressing.
+
+   Repeats are looked for anywhere in the 64KB the compressor can reference.
+   One hash table holds every position of the samples and every
+   LZ4_PROBE_INDEX_STEP'th position of the 64KB before each sample, so a
+   repeat of more than LZ4_PROBE_INDEX_STEP bytes at any distance is found
+   (one of its positions in the sample lines up with an indexed one). */
+#define LZ4_PROBE_MIN_SIZE (16 * 1024)
+#define LZ4_PROBE_CHUNKS 8
+#define LZ4_PROBE_CHUNK_SIZE 512
+#define LZ4_PROBE_INDEX_STEP 64
+#define LZ4_PROBE_WINDOW (64 * 1024 - 1)
+#define LZ4_PROBE_HASH_LOG 11
+
+static uint32_t lz4_probe_hash(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return (v * 2654435761U) >> (32 - LZ4_PROBE_HASH_LOG);
+}
+
+static bool lz4_looks_incompressible(const void *src, uint32_t src_len) {
+  if (src_len < LZ4_PROBE_MIN_SIZE)
+    return false;
+
+  const uint8_t *s = (const uint8_t *)src;
+  uint32_t counts[256];
+  uint32_t table[1 << LZ4_PROBE_HASH_LOG];
+  memset(counts, 0, sizeof(counts));
+  memset(table, 0xFF, sizeof(table));
+  uint32_t matches = 0, positions = 0, indexed = 0;
+  uint32_t step = (src_len - LZ4_PROBE_CHUNK_SIZE) / (LZ4_PROBE_CHUNKS - 1);
+  for (uint32_t i = 0; i < LZ4_PROBE_CHUNKS; i++) {
+    uint32_t pos = i * step;
+    /* the part of the window before the sample which isn't indexed yet */
+    uint32_t from = pos > LZ4_PROBE_WINDOW ? pos - LZ4_PROBE_WINDOW : 0;
+    if (from < indexed)
+      from = indexed;
+    for (uint32_t j = from; j < pos; j += LZ4_PROBE_INDEX_STEP)
+      table[lz4_probe_hash(s + j)] = j;
+
+    for (uint32_t j = pos; j < pos + LZ4_PROBE_CHUNK_SIZE; j++)
+      counts[s[j]]++;
+    uint32_t chunk_end = pos + LZ4_PROBE_CHUNK_SIZE;
+    for (uint32_t j = pos; j + 4 <= chunk_end; j++) {
+      uint32_t h = lz4_probe_hash(s + j);
+      uint32_t m = table[h];
+      table[h] = j;
+      if (m != 0xFFFFFFFFU && j - m <= LZ4_PROBE_WINDOW &&
+          !memcmp(s + m, s + j, 4)) {
+        /* every byte the match covers counts, as only a few positions of a
+           distant repeat line up with the indexed ones */
+        uint32_t len = 4;
+        while (j + len < chunk_end && s[m + len] == s[j + len])
+          len++;
+        matches += len;
+        j += len - 1;
+      }
+    }
+    positions += LZ4_PROBE_CHUNK_SIZE;
+    indexed = pos + LZ4_PROBE_CHUNK_SIZE;
+  }
+  /* the sum of squared counts is n*n/256 for uniformly distributed bytes and
+     grows quickly as the distribution gets skewed */
+  uint64_t n = LZ4_PROBE_CHUNKS * LZ4_PROBE_CHUNK_SIZE, sum = 0;
+  for (uint32_t i = 0; i < 256; i++)
+    sum += (uint64_t)counts[i] * counts[i];
+  return matches < positions / 64 && sum * 256 * 4 < n * n * 5;
+}
+
+/* The adaptive controller steps through the distinct levels between
+   min_level and max_level (0 and 2 are the same as 1), one rung per block.
+   It keeps a moving average of the time per byte and of the compressed size
+   at each rung.  It steps down when the current rung is over the target and
+   up when the next rung is expected to fit and compresses better.  Rungs
+   above are forgotten every LZ4_ADAPTIVE_PROBE blocks, so that they are
+   tried again if the data gets easier to compress. */
+#define LZ4_ADAPTIVE_MIN_LEVEL -32
+#define LZ4_ADAPTIVE_MAX_RUNGS 48
+#define LZ4_ADAPTIVE_PROBE 64
+/* blocks smaller than this are too noisy to time */
+#define LZ4_ADAPTIVE_MIN_BLOCK 4096
+
+typedef struct lz4_adaptive_s {
+  /* ns per byte, 0 to always use the top rung */
+  double target;
+  int rung;
+  int num_rungs;
+  int levels[LZ4_ADAPTIVE_MAX_RUNGS];
+  /* 0 until the rung is used */
+  double cost[LZ4_ADAPTIVE_MAX_RUNGS];
+  double ratio[LZ4_ADAPTIVE_MAX_RUNGS];
+  uint32_t since_probe;
+} lz4_adaptive_t;
+
+/* switches the state between fast and HC if the level needs it */
+static void lz4_adaptive_apply(lz4_t *l) {
+  int level = l->adaptive->levels[l->adaptive->rung];
+  if ((level < LZ4HC_CLEVEL_MIN) != (l->level < LZ4HC_CLEVEL_MIN)) {
+    if (level < LZ4HC_CLEVEL_MIN)
+      LZ4_initStream((LZ4_stream_t *)l->ctx, sizeof(LZ4_stream_t));
+    else
+      LZ4_initStreamHC((LZ4_streamHC_t *)l->ctx, sizeof(LZ4_streamHC_t));
+  }
+  l->level = level;
+}
+
+static void lz4_adaptive_update(lz4_adaptive_t *a, uint32_t src_len,
+                                uint32_t compressed_size, uint64_t ns) {
+  if (src_len < LZ4_ADAPTIVE_MIN_BLOCK)
+    return;
+  int r = a->rung;
+  double cost = (double)ns / src_len;
+  double ratio = (double)compressed_size / src_len;
+  a->cost[r] = a->cost[r] > 0 ? a->cost[r] * 0.75 + cost * 0.25 : cost;
+  a->ratio[r] = a->ratio[r] > 0 ? a->ratio[r] * 0.75 + ratio * 0.25 : ratio;
+  if (a->target <= 0) {
+    a->rung = a->num_rungs - 1;
+    return;
+  }
+  if (++a->since_probe >= LZ4_ADAPTIVE_PROBE) {
+    a->since_probe = 0;
+    for (int i = r + 1; i < a->num_rungs; i++)
+      a->cost[i] = a->ratio[i] = 0;
+  }
+  if (a->cost[r] > a->target) {
+    if (r > 0)
+      a->rung--;
+  } else if (r + 1 < a->num_rungs) {
+    /* a rung which hasn't been used is guessed to take 1.5 times as long */
+    double next_cost = a->cost[r + 1] > 0 ? a->cost[r + 1] : a->cost[r] * 1.5;
+    bool better = a->ratio[r + 1] <= 0 || a->ratio[r + 1] < a->ratio[r] * 0.99;
+    if (next_cost <= a->target && better)
+      a->rung++;
+  }
+}
+
 uint32_t lz4_compress_block(lz4_t *l, const void *src, uint32_t src_len,
                                void *dest, uint32_t dest_len) {
-  if (l->content_checksum)
+  uint64_t start = l->timing ? lz4_now_ns() : 0, checked = start;
+  /* the content checksum is a separate pass over src.  It can't be
+     interleaved with the compressor, which can't compress a block in pieces
+     without changing its output, and hashing before or after compressing
+     costs the same. */
+  if (l->content_checksum) {
     (void)XXH32_update(&l->xxh, src, src_len);
+    if (l->timing)
+      checked = lz4_now_ns();
+  }
 
   char *destp = (char *)dest;
-  uint32_t compressed_size =
-      lz4_compress(l, src, src_len, destp + sizeof(uint32_t),
-                      dest_len - l->block_header_size);
-  if (compressed_size >= src_len) {
+  uint32_t compressed_size = 0;
+  l->stats.blocks++;
+  /* linked blocks and dictionaries give the compressor history the probe
+     doesn't see */
+  if (l->skip_incompressible && !l->linked && !l->dictionary &&
+      lz4_looks_incompressible(src, src_len)) {
+    l->stats.skipped_blocks++;
+  } else {
+    uint64_t began = 0;
+    if (l->adaptive) {
+      lz4_adaptive_apply(l);
+      began = lz4_now_ns();
+    }
+    /* anything which doesn't fit in less than src_len is stored, so the fast
+       compressor can give up as soon as it reaches that.  A failed HC attempt
+       marks the stream dirty (the next reset is a full 256KB initialization
+       and linked history is lost), so HC gets the whole output and the
+       result is compared with src_len instead. */
+    uint32_t budget = dest_len - l->block_header_size;
+    if (l->level < LZ4HC_CLEVEL_MIN && budget >= src_len)
+      budget = src_len ? src_len - 1 : 0;
+    compressed_size =
+        lz4_compress(l, src, src_len, destp + sizeof(uint32_t), budget);
+    /* if dest was too small even so, the stream is left dirty.  Linked
+       streams are never reset, so the history is reloaded from the block
+       (which is stored below) to start clean. */
+    if (!compressed_size && l->linked && l->level >= LZ4HC_CLEVEL_MIN &&
+        src_len) {
+      uint32_t n = src_len < LZ4_LINKED_DICT_SIZE ? src_len
+                                                  : LZ4_LINKED_DICT_SIZE;
+      LZ4_loadDictHC((LZ4_streamHC_t *)l->ctx, (const char *)src + src_len - n,
+                     n);
+      LZ4_saveDictHC((LZ4_streamHC_t *)l->ctx, l->dict, LZ4_LINKED_DICT_SIZE);
+    }
+    if (l->adaptive)
+      lz4_adaptive_update(
+          l->adaptive, src_len,
+          compressed_size && compressed_size < src_len ? compressed_size
+                                                       : src_len,
+          lz4_now_ns() - began);
+  }
+  /* 0 is a failure to compress within the budget (and would be written as
+     the end mark) */
+  if (compressed_size == 0 || compressed_size >= src_len) {
     compressed_size = src_len;
+    l->stats.stored_blocks++;
     write_little_endian_32(destp, src_len | 0x80000000U);
     memcpy(destp + sizeof(uint32_t), src, src_len);
   } else
     write_little_endian_32(destp, compressed_size);
   destp += sizeof(uint32_t);
 
+  uint64_t compressed = l->timing ? lz4_now_ns() : 0, end = compressed;
   if (l->block_checksum) {
     uint32_t crc32 = XXH32(destp, compressed_size, 0);
     write_little_endian_32(destp + compressed_size, crc32);
+    if (l->timing)
+      end = lz4_now_ns();
+  }
+  l->stats.bytes += src_len;
+  l->stats.compressed_bytes += compressed_size + l->block_header_size;
+  if (l->timing) {
+    l->stats.compress_ns += compressed - checked;
+    l->stats.checksum_ns += (checked - start) + (end - compressed);
+  }
+  if (l->seek_table) {
+    uint32_t entry[2] = {compressed_size + l->block_header_size, src_len};
+    aml_buffer_append(l->seek_table, entry, sizeof(entry));
   }
   return compressed_size + l->block_header_size;
 }
 
+void lz4_enable_seek_table(lz4_t *l) {
+  if (!l->seek_table && l->ctx)
+    l->seek_table = aml_buffer_init(1024);
+}
+
+size_t lz4_write_seek_table(lz4_t *l, aml_buffer_t *dest) {
+  if (!l->seek_table)
+    return 0;
+  uint32_t entries_size = aml_buffer_length(l->seek_table);
+  char *p = (char *)aml_buffer_append_ualloc(dest, entries_size + 16);
+  write_little_endian_32(p, LZ4_SEEK_TABLE_FRAME_MAGIC);
+  write_little_endian_32(p + 4, entries_size + 8);
+  memcpy(p + 8, aml_buffer_data(l->seek_table), entries_size);
+  write_little_endian_32(p + 8 + entries_size, entries_size / 8);
+  write_little_endian_32(p + 12 + entries_size, LZ4_SEEK_TABLE_MAGIC);
+  return entries_size + 16;
+}
+
+uint32_t lz4_header_size(const void *header, uint32_t len) {
+  const char *h = (const char *)header;
+  if (len < 5 || read_little_endian_32((char *)h) != LZ4_FRAME_MAGIC)
+    return 0;
+  uint8_t flg = (uint8_t)h[4];
+  return 7 + ((flg & LZ4_FLG_CONTENT_SIZE) ? 8 : 0) +
+         ((flg & LZ4_FLG_DICT_ID) ? 4 : 0);
+}
+
+uint32_t lz4_write_header(void *dest, const lz4_header_t *h) {
+  char *d = (char *)dest;
+  write_little_endian_32(d, LZ4_FRAME_MAGIC);
+  uint8_t flg = LZ4_FLG_VERSION;
+  if (!h->linked_blocks)
+    flg |= LZ4_FLG_BLOCK_INDEPENDENCE;
+  if (h->block_checksum)
+    flg |= LZ4_FLG_BLOCK_CHECKSUM;
+  if (h->has_content_size)
+    flg |= LZ4_FLG_CONTENT_SIZE;
+  if (h->content_checksum)
+    flg |= LZ4_FLG_CONTENT_CHECKSUM;
+  if (h->has_dict_id)
+    flg |= LZ4_FLG_DICT_ID;
+  d[4] = (char)flg;
+  d[5] = (char)((h->size + 4) << 4);
+  char *p = d + 6;
+  if (h->has_content_size) {
+    write_little_endian_64(p, h->content_size);
+    p += 8;
+  }
+  if (h->has_dict_id) {
+    write_little_endian_32(p, h->dict_id);
+    p += 4;
+  }
+  *p = (char)lz4_descriptor_checksum((uint8_t *)d + 4, p - (d + 4));
+  return (p + 1) - d;
+}
+
 bool lz4_check_header(lz4_header_t *r, void *header,
                          uint32_t header_size) {
-  if (header_size != 7 || !r)
+  uint32_t size = lz4_header_size(header, header_size);
+  if (!size || header_size < size || !r)
     return false;
-  uint8_t *h = (uint8_t *)header;
-  if (h[0] != _64kb[0] || h[1] != _64kb[1] || h[2] != _64kb[2] ||
-      h[3] != _64kb[3])
+  char *h = (char *)header;
+  uint8_t flg = (uint8_t)h[4];
+  uint8_t bd = (uint8_t)h[5];
+  /* version 01 and the reserved bits must be zero */
+  if ((flg & 0xC2) != LZ4_FLG_VERSION || (bd & 0x8F))
     return false;
-  lz4_block_size_t size;
-  bool block_checksum;
-  bool content_checksum;
-  uint32_t block_size;
-  uint8_t *headerp;
-
-  if (h[5] == 0x40) {
-    size = s64kb;
-    block_size = 64 * 1024;
-    if (h[4] == _64kb[4] && h[6] == _64kb[6]) {
-      headerp = &_64kb[0];
-      block_checksum = false;
-      content_checksum = false;
-    } else if (h[4] == b_64kb[4] && h[6] == b_64kb[6]) {
-      headerp = &b_64kb[0];
-      block_checksum = true;
-      content_checksum = false;
-    } else if (h[4] == c_64kb[4] && h[6] == c_64kb[6]) {
-      headerp = &c_64kb[0];
-      block_checksum = false;
-      content_checksum = true;
-    } else if (h[4] == cb_64kb[4] && h[6] == cb_64kb[6]) {
-      headerp = &cb_64kb[0];
-      block_checksum = true;
-      content_checksum = true;
-    } else
-      return false;
-  } else if (h[5] == 0x50) {
-    size = s256kb;
-    block_size = 256 * 1024;
-    if (h[4] == _256kb[4] && h[6] == _256kb[6]) {
-      headerp = &_256kb[0];
-      block_checksum = false;
-      content_checksum = false;
-    } else if (h[4] == b_256kb[4] && h[6] == b_256kb[6]) {
-      headerp = &b_256kb[0];
-      block_checksum = true;
-      content_checksum = false;
-    } else if (h[4] == c_256kb[4] && h[6] == c_256kb[6]) {
-      headerp = &c_256kb[0];
-      block_checksum = false;
-      content_checksum = true;
-    } else if (h[4] == cb_256kb[4] && h[6] == cb_256kb[6]) {
-      headerp = &cb_256kb[0];
-      block_checksum = true;
-      content_checksum = true;
-    } else
-      return false;
-  } else if (h[5] == 0x60) {
-    size = s1mb;
-    block_size = 1024 * 1024;
-    if (h[4] == _1mb[4] && h[6] == _1mb[6]) {
-      headerp = &_1mb[0];
-      block_checksum = false;
-      content_checksum = false;
-    } else if (h[4] == b_1mb[4] && h[6] == b_1mb[6]) {
-      headerp = &b_1mb[0];
-      block_checksum = true;
-      content_checksum = false;
-    } else if (h[4] == c_1mb[4] && h[6] == c_1mb[6]) {
-      headerp = &c_1mb[0];
-      block_checksum = false;
-      content_checksum = true;
-    } else if (h[4] == cb_1mb[4] && h[6] == cb_1mb[6]) {
-      headerp = &cb_1mb[0];
-      block_checksum = true;
-      content_checksum = true;
-    } else
-      return false;
-  } else if (h[5] == 0x70) {
-    size = s4mb;
-    block_size = 4 * 1024 * 1024;
-    if (h[4] == _4mb[4] && h[6] == _4mb[6]) {
-      headerp = &_4mb[0];
-      block_checksum = false;
-      content_checksum = false;
-    } else if (h[4] == b_4mb[4] && h[6] == b_4mb[6]) {
-      headerp = &b_4mb[0];
-      block_checksum = true;
-      content_checksum = false;
-    } else if (h[4] == c_4mb[4] && h[6] == c_4mb[6]) {
-      headerp = &c_4mb[0];
-      block_checksum = false;
-      content_checksum = true;
-    } else if (h[4] == cb_4mb[4] && h[6] == cb_4mb[6]) {
-      headerp = &cb_4mb[0];
-      block_checksum = true;
-      content_checksum = true;
-    } else
-      return false;
-  } else
+  uint8_t block_max = (bd >> 4) & 7;
+  if (block_max < 4)
     return false;
-  uint32_t compressed_size = LZ4_compressBound(block_size);
-  r->compressed_size = compressed_size;
-  r->block_size = block_size;
-  r->block_checksum = block_checksum;
-  r->content_checksum = content_checksum;
-  r->header = (char *)headerp;
+  if ((uint8_t)h[size - 1] !=
+      lz4_descriptor_checksum((uint8_t *)h + 4, size - 5))
+    return false;
+
+  char *p = h + 6;
+  r->has_content_size = (flg & LZ4_FLG_CONTENT_SIZE) ? true : false;
+  r->content_size = 0;
+  if (r->has_content_size) {
+    r->content_size = read_little_endian_64(p);
+    p += 8;
+  }
+  r->has_dict_id = (flg & LZ4_FLG_DICT_ID) ? true : false;
+  r->dict_id = 0;
+  if (r->has_dict_id)
+    r->dict_id = read_little_endian_32(p);
+
+  r->size = (lz4_block_size_t)(block_max - 4);
+  r->block_size = (64 * 1024) << (2 * r->size);
+  r->compressed_size = LZ4_compressBound(r->block_size);
+  r->block_checksum = (flg & LZ4_FLG_BLOCK_CHECKSUM) ? true : false;
+  r->content_checksum = (flg & LZ4_FLG_CONTENT_CHECKSUM) ? true : false;
+  r->linked_blocks = (flg & LZ4_FLG_BLOCK_INDEPENDENCE) ? false : true;
+  r->header = h;
+  r->header_size = size;
   return true;
 }
 
@@ -315,12 +847,26 @@ lz4_t *_lz4_init_decompress(void *header, uint32_t header_size) {
   if (!lz4_check_header(&h, header, header_size))
     return NULL;
 
+  uint32_t linked_size = h.linked_blocks
+                            ? sizeof(LZ4_streamDecode_t) + LZ4_LINKED_DICT_SIZE
+                            : 0;
 #ifdef _AML_DEBUG_
-  lz4_t *r = (lz4_t *)_aml_malloc_d(caller, sizeof(lz4_t), false);
+  lz4_t *r = (lz4_t *)_aml_malloc_d(caller, sizeof(lz4_t) + linked_size,
+                                    false);
 #else
-  lz4_t *r = (lz4_t *)aml_malloc(sizeof(lz4_t));
+  lz4_t *r = (lz4_t *)aml_malloc(sizeof(lz4_t) + linked_size);
 #endif
   r->ctx = NULL;
+  r->seek_table = NULL;
+  r->linked = h.linked_blocks;
+  r->dict_size = 0;
+  if (r->linked) {
+    r->dctx = (LZ4_streamDecode_t *)(r + 1);
+    r->dict = (char *)(r->dctx + 1);
+  } else {
+    r->dctx = NULL;
+    r->dict = NULL;
+  }
   r->level = 1;
   r->block_size = h.block_size;
   r->compressed_size = h.compressed_size;
@@ -328,60 +874,68 @@ lz4_t *_lz4_init_decompress(void *header, uint32_t header_size) {
   r->content_checksum = h.content_checksum;
   r->block_checksum = h.block_checksum;
   r->block_header_size = h.block_checksum ? 4 : 0;
-  r->header = (uint8_t *)h.header;
-  r->header_size = 7;
+  r->has_content_size = h.has_content_size;
+  r->content_size = h.content_size;
+  r->dict_id = h.dict_id;
+  r->dictionary = NULL;
+  memset(&r->stats, 0, sizeof(r->stats));
+  r->timing = false;
+  r->skip_incompressible = true;
+  r->adaptive = NULL;
+  memcpy(r->header_buf, header, h.header_size);
+  r->header = r->header_buf;
+  r->header_size = h.header_size;
   if (h.content_checksum)
     XXH32_reset(&(r->xxh), 0);
   return r;
 }
 
-#ifdef _AML_DEBUG_
-lz4_t *_lz4_init(int level, lz4_block_size_t size, bool block_checksum,
-                       bool content_checksum, const char *caller) {
-#else
-lz4_t *_lz4_init(int level, lz4_block_size_t size, bool block_checksum,
-                       bool content_checksum) {
-#endif
+static void lz4_update_header(lz4_t *r) {
+  lz4_header_t h;
+  h.size = r->size;
+  h.block_checksum = r->block_checksum;
+  h.content_checksum = r->content_checksum;
+  h.linked_blocks = r->linked;
+  h.has_content_size = r->has_content_size;
+  h.content_size = r->content_size;
+  h.has_dict_id = r->dict_id != 0;
+  h.dict_id = r->dict_id;
+  r->header_size = lz4_write_header(r->header_buf, &h);
+}
+
+void lz4_set_content_size(lz4_t *r, uint64_t content_size) {
+  if (!r->ctx)
+    return;
+  r->has_content_size = true;
+  r->content_size = content_size;
+  lz4_update_header(r);
+}
+
+static lz4_t *lz4_init_common(int level, lz4_block_size_t size,
+                              bool block_checksum, bool content_checksum,
+                              bool linked, const char *caller) {
   uint32_t ctx_size =
       level < LZ4HC_CLEVEL_MIN ? sizeof(LZ4_stream_t) : sizeof(LZ4_streamHC_t);
-  uint8_t *header;
-  uint32_t block_size;
-  if (size == s64kb) {
-    if (!content_checksum)
-      header = block_checksum ? &b_64kb[0] : &_64kb[0];
-    else
-      header = block_checksum ? &cb_64kb[0] : &c_64kb[0];
-    block_size = 64 * 1024;
-  } else if (size == s256kb) {
-    if (!content_checksum)
-      header = block_checksum ? &b_256kb[0] : &_256kb[0];
-    else
-      header = block_checksum ? &cb_256kb[0] : &c_256kb[0];
-    block_size = 256 * 1024;
-  } else if (size == s1mb) {
-    if (!content_checksum)
-      header = block_checksum ? &b_1mb[0] : &_1mb[0];
-    else
-      header = block_checksum ? &cb_1mb[0] : &c_1mb[0];
-    block_size = 1024 * 1024;
-  } else if (size == s4mb) {
-    if (!content_checksum)
-      header = block_checksum ? &b_4mb[0] : &_4mb[0];
-    else
-      header = block_checksum ? &cb_4mb[0] : &c_4mb[0];
-    block_size = 4 * 1024 * 1024;
-  } else
+  uint32_t dict_size = linked ? LZ4_LINKED_DICT_SIZE : 0;
+  if (size < s64kb || size > s4mb)
     return NULL;
+  uint32_t block_size = (64 * 1024) << (2 * size);
 
   uint32_t compressed_size = LZ4_compressBound(block_size);
 
 #ifdef _AML_DEBUG_
-  lz4_t *r = (lz4_t *)_aml_malloc_d(caller,
-                                         sizeof(lz4_t) + ctx_size, false);
+  lz4_t *r = (lz4_t *)_aml_malloc_d(
+      caller, sizeof(lz4_t) + ctx_size + dict_size, false);
 #else
-  lz4_t *r = (lz4_t *)aml_malloc(sizeof(lz4_t) + ctx_size);
+  (void)caller;
+  lz4_t *r = (lz4_t *)aml_malloc(sizeof(lz4_t) + ctx_size + dict_size);
 #endif
   r->ctx = (void *)(r + 1);
+  r->seek_table = NULL;
+  r->linked = linked;
+  r->dict = linked ? (char *)r->ctx + ctx_size : NULL;
+  r->dict_size = 0;
+  r->dctx = NULL;
   r->level = level;
   r->block_size = block_size;
   r->compressed_size = compressed_size;
@@ -389,8 +943,18 @@ lz4_t *_lz4_init(int level, lz4_block_size_t size, bool block_checksum,
   r->content_checksum = content_checksum;
   r->block_checksum = block_checksum;
   r->block_header_size = 4 + (block_checksum ? 4 : 0);
-  r->header = header;
-  r->header_size = 7;
+  r->has_content_size = false;
+  r->content_size = 0;
+  r->dict_id = 0;
+  r->dictionary = NULL;
+  memset(&r->stats, 0, sizeof(r->stats));
+  r->timing = false;
+  r->skip_incompressible = true;
+  r->adaptive = NULL;
+  r->header = r->header_buf;
+  lz4_update_header(r);
+  if (content_checksum)
+    XXH32_reset(&(r->xxh), 0);
   if (level < LZ4HC_CLEVEL_MIN) {
     LZ4_initStream((LZ4_stream_t *)r->ctx, sizeof(LZ4_stream_t));
   } else {
@@ -400,52 +964,445 @@ lz4_t *_lz4_init(int level, lz4_block_size_t size, bool block_checksum,
   return r;
 }
 
-void lz4_destroy(lz4_t *r) { aml_free(r); }
+#ifdef _AML_DEBUG_
+lz4_t *_lz4_init(int level, lz4_block_size_t size, bool block_checksum,
+                       bool content_checksum, const char *caller) {
+  return lz4_init_common(level, size, block_checksum, content_checksum, false,
+                         caller);
+}
 
-size_t lz4_compress_appending_to_buffer(aml_buffer_t *dest, void *src, int src_size, int level) {
-    int max_dst_size = LZ4_compressBound(src_size);
-    size_t olen = aml_buffer_length(dest);
+lz4_t *_lz4_init_linked(int level, lz4_block_size_t size,
+                        bool block_checksum, bool content_checksum,
+                        const char *caller) {
+  return lz4_init_common(level, size, block_checksum, content_checksum, true,
+                         caller);
+}
+#else
+lz4_t *_lz4_init(int level, lz4_block_size_t size, bool block_checksum,
+                       bool content_checksum) {
+  return lz4_init_common(level, size, block_checksum, content_checksum, false,
+                         NULL);
+}
 
-    // Allocate space for both the compressed data and the HC stream
-    size_t hc_stream_size = (level > 0) ? (sizeof(LZ4_streamHC_t)+8) : 0;
-    void *dst = (void *)aml_buffer_append_ualloc(dest, max_dst_size + hc_stream_size);
+lz4_t *_lz4_init_linked(int level, lz4_block_size_t size,
+                        bool block_checksum, bool content_checksum) {
+  return lz4_init_common(level, size, block_checksum, content_checksum, true,
+                         NULL);
+}
+#endif
 
-    if (!dst) {
-        return 0; // Memory allocation failed
+static lz4_t *lz4_init_adaptive_common(int min_level, int max_level,
+                                       lz4_block_size_t size,
+                                       bool block_checksum,
+                                       bool content_checksum,
+                                       const char *caller) {
+  if (min_level < LZ4_ADAPTIVE_MIN_LEVEL)
+    min_level = LZ4_ADAPTIVE_MIN_LEVEL;
+  if (max_level > LZ4HC_CLEVEL_MAX)
+    max_level = LZ4HC_CLEVEL_MAX;
+  if (max_level < min_level)
+    max_level = min_level;
+  /* the state is sized (and initialized) for the top level */
+  lz4_t *r = lz4_init_common(max_level, size, block_checksum,
+                             content_checksum, false, caller);
+  if (!r)
+    return NULL;
+  lz4_adaptive_t *a = (lz4_adaptive_t *)aml_malloc(sizeof(lz4_adaptive_t));
+  memset(a, 0, sizeof(*a));
+  for (int level = min_level; level <= max_level; level++)
+    if (level != 0 && level != 2)
+      a->levels[a->num_rungs++] = level;
+  if (!a->num_rungs)
+    a->levels[a->num_rungs++] = 1;
+  a->rung = a->num_rungs - 1;
+  r->adaptive = a;
+  lz4_adaptive_apply(r);
+  return r;
+}
+
+#ifdef _AML_DEBUG_
+lz4_t *_lz4_init_adaptive(int min_level, int max_level,
+                          lz4_block_size_t size, bool block_checksum,
+                          bool content_checksum, const char *caller) {
+  return lz4_init_adaptive_common(min_level, max_level, size, block_checksum,
+                                  content_checksum, caller);
+}
+#else
+lz4_t *_lz4_init_adaptive(int min_level, int max_level,
+                          lz4_block_size_t size, bool block_checksum,
+                          bool content_checksum) {
+  return lz4_init_adaptive_common(min_level, max_level, size, block_checksum,
+                                  content_checksum, NULL);
+}
+#endif
+
+/* starts from the level closest to 1 (the default fast level) */
+static void lz4_set_target(lz4_t *l, double ns_per_byte) {
+  lz4_adaptive_t *a = l->adaptive;
+  if (!a)
+    return;
+  a->target = ns_per_byte;
+  a->rung = a->num_rungs - 1;
+  if (ns_per_byte > 0)
+    for (int i = a->num_rungs - 1; i > 0 && a->levels[i] > 1; i--)
+      a->rung = i - 1;
+  for (int i = 0; i < a->num_rungs; i++)
+    a->cost[i] = a->ratio[i] = 0;
+  a->since_probe = 0;
+}
+
+void lz4_set_target_speed(lz4_t *l, double mb_s) {
+  lz4_set_target(l, mb_s > 0 ? 1000.0 / mb_s : 0);
+}
+
+void lz4_set_block_budget(lz4_t *l, uint64_t ns) {
+  lz4_set_target(l, (double)ns / l->block_size);
+}
+
+int lz4_level(lz4_t *l) {
+  return l->adaptive ? l->adaptive->levels[l->adaptive->rung] : l->level;
+}
+
+lz4_dict_t *lz4_dict_init(const void *dict, size_t dict_size,
+                          uint32_t dict_id) {
+  const char *dictp = (const char *)dict;
+  if (dict_size > LZ4_DICT_MAX_SIZE) {
+    dictp += dict_size - LZ4_DICT_MAX_SIZE;
+    dict_size = LZ4_DICT_MAX_SIZE;
+  }
+  lz4_dict_t *d = (lz4_dict_t *)aml_malloc(
+      sizeof(lz4_dict_t) + sizeof(LZ4_streamHC_t) + sizeof(LZ4_stream_t) +
+      dict_size);
+  d->hc = (LZ4_streamHC_t *)(d + 1);
+  d->fast = (LZ4_stream_t *)(d->hc + 1);
+  d->data = (char *)(d->fast + 1);
+  d->size = dict_size;
+  memcpy(d->data, dictp, dict_size);
+  if (!dict_id) {
+    dict_id = XXH32(d->data, dict_size, 0);
+    if (!dict_id)
+      dict_id = 1;
+  }
+  d->id = dict_id;
+  atomic_init(&d->refs, 1);
+
+  LZ4_initStream(d->fast, sizeof(LZ4_stream_t));
+  LZ4_loadDict(d->fast, d->data, dict_size);
+  LZ4_initStreamHC(d->hc, sizeof(LZ4_streamHC_t));
+  LZ4_setCompressionLevel(d->hc, LZ4HC_CLEVEL_DEFAULT);
+  LZ4_loadDictHC(d->hc, d->data, dict_size);
+  return d;
+}
+
+uint32_t lz4_dict_id(lz4_dict_t *d) { return d->id; }
+
+const void *lz4_dict_data(lz4_dict_t *d, size_t *dict_size) {
+  *dict_size = d->size;
+  return d->data;
+}
+
+lz4_dict_t *lz4_dict_retain(lz4_dict_t *d) {
+  atomic_fetch_add_explicit(&d->refs, 1, memory_order_relaxed);
+  return d;
+}
+
+void lz4_dict_release(lz4_dict_t *d) {
+  if (d && atomic_fetch_sub_explicit(&d->refs, 1, memory_order_acq_rel) == 1)
+    aml_free(d);
+}
+
+void lz4_dict_destroy(lz4_dict_t *d) { lz4_dict_release(d); }
+
+bool lz4_set_dictionary(lz4_t *l, lz4_dict_t *dict) {
+  if (!l->ctx) {
+    if (!dict || dict->id != l->dict_id)
+      return false;
+    lz4_dict_release(l->dictionary);
+    l->dictionary = lz4_dict_retain(dict);
+    /* linked frames start with the dictionary as history */
+    if (l->linked) {
+      l->dict_size = 0;
+      lz4_update_dict(l, dict->data, dict->size);
     }
+    return true;
+  }
+  if (dict)
+    lz4_dict_retain(dict);
+  lz4_dict_release(l->dictionary);
+  l->dictionary = dict;
+  l->dict_id = dict ? dict->id : 0;
+  if (l->linked && dict) {
+    /* history continues from the dictionary, it is loaded once per frame */
+    if (l->level < LZ4HC_CLEVEL_MIN)
+      LZ4_loadDict((LZ4_stream_t *)l->ctx, dict->data, dict->size);
+    else
+      LZ4_loadDictHC((LZ4_streamHC_t *)l->ctx, dict->data, dict->size);
+  }
+  lz4_update_header(l);
+  return true;
+}
 
-    int compressed_data_size = 0;
+void lz4_get_stats(lz4_t *l, lz4_stats_t *stats) { *stats = l->stats; }
+
+void lz4_reset_stats(lz4_t *l) { memset(&l->stats, 0, sizeof(l->stats)); }
 
+void lz4_enable_timing(lz4_t *l, bool enable) { l->timing = enable; }
+
+void lz4_set_skip_incompressible(lz4_t *l, bool skip) {
+  l->skip_incompressible = skip;
+}
+
+void lz4_destroy(lz4_t *r) {
+  lz4_dict_release(r->dictionary);
+  if (r->adaptive)
+    aml_free(r->adaptive);
+  if (r->seek_table)
+    aml_buffer_destroy(r->seek_table);
+  aml_free(r);
+}
+
+/* Each thread keeps its compression states between calls so that small
+   records don't pay for initializing a 16KB (fast) or 256KB (HC) state every
+   time.  The states are only reset with the *_fastReset entry points and are
+   freed when the thread exits. */
+typedef struct {
+    LZ4_stream_t *fast;
+    LZ4_streamHC_t *hc;
+} lz4_thread_state_t;
+
+static pthread_key_t lz4_thread_state_key;
+static pthread_once_t lz4_thread_state_once = PTHREAD_ONCE_INIT;
+
+static void lz4_thread_state_free(void *arg) {
+    lz4_thread_state_t *ts = (lz4_thread_state_t *)arg;
+    if (ts->fast)
+        aml_free(ts->fast);
+    if (ts->hc)
+        aml_free(ts->hc);
+    aml_free(ts);
+}
+
+static void lz4_thread_state_key_init(void) {
+    pthread_key_create(&lz4_thread_state_key, lz4_thread_state_free);
+}
+
+static lz4_thread_state_t *lz4_thread_state(void) {
+    pthread_once(&lz4_thread_state_once, lz4_thread_state_key_init);
+    lz4_thread_state_t *ts = (lz4_thread_state_t *)pthread_getspecific(lz4_thread_state_key);
+    if (!ts) {
+        ts = (lz4_thread_state_t *)aml_malloc(sizeof(lz4_thread_state_t));
+        ts->fast = NULL;
+        ts->hc = NULL;
+        pthread_setspecific(lz4_thread_state_key, ts);
+    }
+    return ts;
+}
+
+static LZ4_stream_t *lz4_thread_fast_state(void) {
+    lz4_thread_state_t *ts = lz4_thread_state();
+    if (!ts->fast) {
+        ts->fast = (LZ4_stream_t *)aml_malloc(sizeof(LZ4_stream_t));
+        LZ4_initStream(ts->fast, sizeof(LZ4_stream_t));
+    }
+    return ts->fast;
+}
+
+static LZ4_streamHC_t *lz4_thread_hc_state(void) {
+    lz4_thread_state_t *ts = lz4_thread_state();
+    if (!ts->hc) {
+        ts->hc = (LZ4_streamHC_t *)aml_malloc(sizeof(LZ4_streamHC_t));
+        LZ4_initStreamHC(ts->hc, sizeof(LZ4_streamHC_t));
+    }
+    return ts->hc;
+}
+
+static int lz4_compress_thread_with_dict(const void *src, void *dst, int src_size, int dst_size, int level,
+                                         lz4_dict_t *dict) {
+    if (level <= 0) {
+        LZ4_stream_t *ctx = lz4_thread_fast_state();
+        LZ4_resetStream_fast(ctx);
+        LZ4_attach_dictionary(ctx, dict->fast);
+        return kernels.compress_fast_continue(ctx, (const char *)src, (char *)dst, src_size, dst_size, 1);
+    }
+    LZ4_streamHC_t *ctx = lz4_thread_hc_state();
+    LZ4_resetStreamHC_fast(ctx, level);
+    LZ4_attach_HC_dictionary(ctx, dict->hc);
+    return kernels.compress_hc_continue(ctx, (const char *)src, (char *)dst, src_size, dst_size);
+}
+
+static int lz4_compress_thread(const void *src, void *dst, int src_size, int dst_size, int level) {
     if (level <= 0) {
         // Use default compression (fast mode)
-        compressed_data_size = LZ4_compress_default((const char *)src, (char *)dst, src_size, max_dst_size);
-    } else {
-        // Use high-compression mode
-        char *ep = dst+max_dst_size;
-        ep += 8 - ((size_t)ep & 7); // Ensure 8-byte alignment
-        LZ4_streamHC_t *hc_stream = (LZ4_streamHC_t *)ep; // Place HC stream after the compressed data space
+        return kernels.compress_fast_ext_state_fast_reset(
+            lz4_thread_fast_state(), (const char *)src, (char *)dst, src_size, dst_size, 1);
+    }
+    // Use high-compression mode
+    return kernels.compress_hc_ext_state_fast_reset(
+        lz4_thread_hc_state(), (const char *)src, (char *)dst, src_size, dst_size, level);
+}
 
-        // Initialize the stream
-        LZ4_initStreamHC(hc_stream, sizeof(LZ4_streamHC_t));
-        LZ4_setCompressionLevel(hc_stream, level);
+size_t lz4_compress_appending_to_buffer(aml_buffer_t *dest, void *src, int src_size, int level) {
+    int max_dst_size = LZ4_compressBound(src_size);
+    size_t olen = aml_buffer_length(dest);
 
-        compressed_data_size = LZ4_compress_HC_extStateHC(hc_stream, (const char *)src, (char *)dst, src_size, max_dst_size, level);
+    void *dst = (void *)aml_buffer_append_ualloc(dest, max_dst_size);
+
+    if (!dst) {
+        return 0; // Memory allocation failed
     }
 
+    int compressed_data_size = lz4_compress_thread(src, dst, src_size, max_dst_size, level);
+
     if (compressed_data_size <= 0) {
         // Compression failed, revert buffer size
         aml_buffer_resize(dest, olen);
         return 0;
     }
 
-    // Resize the buffer to match the compressed data size (ignore HC stream memory)
     aml_buffer_resize(dest, olen + compressed_data_size);
     return compressed_data_size;
 }
 
+size_t lz4_compress_appending_to_buffer_with_dict(aml_buffer_t *dest, const void *src, int src_size, int level,
+                                                  lz4_dict_t *dict) {
+    int max_dst_size = LZ4_compressBound(src_size);
+    size_t olen = aml_buffer_length(dest);
+    void *dst = (void *)aml_buffer_append_ualloc(dest, max_dst_size);
+    if (!dst)
+        return 0;
+
+    int compressed_data_size = lz4_compress_thread_with_dict(src, dst, src_size, max_dst_size, level, dict);
+    if (compressed_data_size <= 0) {
+        aml_buffer_resize(dest, olen);
+        return 0;
+    }
+    aml_buffer_resize(dest, olen + compressed_data_size);
+    return compressed_data_size;
+}
+
+bool lz4_decompress_into_fixed_buffer_with_dict(void *dest, int dest_size, const void *src, int src_size,
+                                                lz4_dict_t *dict) {
+  int decompressed_size = kernels.decompress_safe_using_dict((const char *)src, (char *)dest, src_size, dest_size,
+                                                             dict->data, dict->size);
+  return decompressed_size == dest_size;
+}
+
 bool lz4_decompress_into_fixed_buffer(void *dest, int dest_size, void *src, int src_size) {
-  int decompressed_size = LZ4_decompress_safe((const char *)src, (char *)dest, src_size, dest_size);
+  int decompressed_size = kernels.decompress_safe((const char *)src, (char *)dest, src_size, dest_size);
   if (decompressed_size != dest_size)
     return false;
   return true;
 }
+
+/* record flags */
+#define LZ4_RECORD_CHECKSUM 0x80
+#define LZ4_RECORD_STORED 0x40
+#define LZ4_RECORD_LEVEL_MASK 0x0F
+
+/* the largest varint for a size which fits in an int */
+#define LZ4_RECORD_MAX_HEADER (5 + 1 + 4)
+
+static size_t lz4_write_varint(char *dest, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        dest[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    dest[n++] = (char)v;
+    return n;
+}
+
+static size_t lz4_read_varint(const char *src, size_t src_size, uint32_t *v) {
+    uint32_t r = 0;
+    for (size_t i = 0; i < src_size && i < 5; i++) {
+        uint8_t b = (uint8_t)src[i];
+        r |= (uint32_t)(b & 0x7F) << (7 * i);
+        if (!(b & 0x80)) {
+            *v = r;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+size_t lz4_compress_record_appending_to_buffer(aml_buffer_t *dest, const void *src, int src_size,
+                                               int level, bool checksum) {
+    if (src_size < 0)
+        return 0;
+    size_t olen = aml_buffer_length(dest);
+    int max_dst_size = LZ4_compressBound(src_size);
+    char *dst = (char *)aml_buffer_append_ualloc(dest, LZ4_RECORD_MAX_HEADER + max_dst_size);
+    if (!dst)
+        return 0;
+
+    char *p = dst + lz4_write_varint(dst, src_size);
+    char *flags = p++;
+    *flags = (char)(level <= 0 ? 0 : (level > LZ4HC_CLEVEL_MAX ? LZ4HC_CLEVEL_MAX : level));
+    if (checksum) {
+        *flags |= LZ4_RECORD_CHECKSUM;
+        write_little_endian_32(p, XXH32(src, src_size, 0));
+        p += 4;
+    }
+
+    int compressed_data_size = 0;
+    if (src_size)
+        compressed_data_size = lz4_compress_thread(src, p, src_size, max_dst_size, level);
+    if (compressed_data_size <= 0 || compressed_data_size >= src_size) {
+        // Store records which don't compress
+        *flags |= LZ4_RECORD_STORED;
+        memcpy(p, src, src_size);
+        compressed_data_size = src_size;
+    }
+    p += compressed_data_size;
+    aml_buffer_resize(dest, olen + (p - dst));
+    return p - dst;
+}
+
+int64_t lz4_record_size(const void *src, size_t src_size) {
+    uint32_t size;
+    if (!lz4_read_varint((const char *)src, src_size, &size) || size > INT32_MAX)
+        return -1;
+    return size;
+}
+
+bool lz4_decompress_record_appending_to_buffer(aml_buffer_t *dest, const void *src, size_t src_size) {
+    const char *p = (const char *)src;
+    const char *ep = p + src_size;
+    uint32_t size;
+    size_t n = lz4_read_varint(p, src_size, &size);
+    if (!n || size > INT32_MAX || p + n >= ep)
+        return false;
+    p += n;
+    uint8_t flags = (uint8_t)*p++;
+    uint32_t expected_checksum = 0;
+    if (flags & LZ4_RECORD_CHECKSUM) {
+        if (ep - p < 4)
+            return false;
+        expected_checksum = read_little_endian_32((char *)p);
+        p += 4;
+    }
+
+    // The size is untrusted, so it is checked against the data before the
+    // output is allocated (LZ4 expands at most 255 times)
+    size_t data_size = ep - p;
+    if (flags & LZ4_RECORD_STORED) {
+        if (data_size != size)
+            return false;
+    } else if ((size && !data_size) || size > (uint64_t)data_size * 255)
+        return false;
+
+    // The size is known, so the output is allocated exactly once
+    size_t olen = aml_buffer_length(dest);
+    char *out = (char *)aml_buffer_append_ualloc(dest, size);
+    bool ok;
+    if (flags & LZ4_RECORD_STORED) {
+        memcpy(out, p, size);
+        ok = true;
+    } else
+        ok = kernels.decompress_safe(p, out, ep - p, size) == (int)size;
+    if (ok && (flags & LZ4_RECORD_CHECKSUM) && XXH32(out, size, 0) != expected_checksum)
+        ok = false;
+    if (!ok)
+        aml_buffer_resize(dest, olen);
+    return ok;
+}
@@ -0,0 +1,342 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "the-lz4-library/lz4_async.h"
+#include "the-lz4-library/lz4_seekable.h"
+
+#include "lz4_io_engine.h"
+
+#include "a-memory-library/aml_alloc.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LZ4_ASYNC_QUEUE_DEPTH 8
+
+static bool pwrite_fully(int fd, const void *data, size_t len,
+                         uint64_t offset) {
+  const char *p = (const char *)data;
+  while (len) {
+    ssize_t n = pwrite(fd, p, len, offset);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+/* true if a write (or a request which was never submitted) completed */
+static bool wait_write(lz4_io_engine_t *e, lz4_io_req_t *req) {
+  return lz4_io_engine_wait(e, req) == (int64_t)req->len;
+}
+
+bool lz4_async_uses_io_uring(void) {
+  lz4_io_engine_t *e = lz4_io_engine_init(1, NULL, 0);
+  if (!e)
+    return false;
+  bool r = lz4_io_engine_uring(e);
+  lz4_io_engine_destroy(e);
+  return r;
+}
+
+typedef struct {
+  char *in;
+  char *out;
+  uint32_t in_len;
+  lz4_io_req_t read;
+  lz4_io_req_t write;
+} lz4_async_slot_t;
+
+int64_t lz4_async_compress(lz4_t *l, int src_fd, int dest_fd,
+                           int queue_depth) {
+  struct stat st;
+  if (fstat(src_fd, &st))
+    return -1;
+  uint64_t size = st.st_size;
+  uint32_t block_size = lz4_block_size(l);
+  uint32_t compressed_size = lz4_compressed_size(l);
+  uint64_t num_blocks = (size + block_size - 1) / block_size;
+  if (queue_depth <= 0)
+    queue_depth = LZ4_ASYNC_QUEUE_DEPTH;
+  if ((uint64_t)queue_depth > num_blocks)
+    queue_depth = num_blocks ? num_blocks : 1;
+
+  size_t slot_size = block_size + compressed_size;
+  lz4_async_slot_t *slots = (lz4_async_slot_t *)aml_malloc(
+      (sizeof(lz4_async_slot_t) + slot_size + sizeof(struct iovec) * 2) *
+      queue_depth);
+  memset(slots, 0, sizeof(lz4_async_slot_t) * queue_depth);
+  struct iovec *iov = (struct iovec *)(slots + queue_depth);
+  char *buffers = (char *)(iov + queue_depth * 2);
+  for (int i = 0; i < queue_depth; i++) {
+    slots[i].in = buffers + slot_size * i;
+    slots[i].out = slots[i].in + block_size;
+    iov[i * 2].iov_base = slots[i].in;
+    iov[i * 2].iov_len = block_size;
+    iov[i * 2 + 1].iov_base = slots[i].out;
+    iov[i * 2 + 1].iov_len = compressed_size;
+  }
+  lz4_io_engine_t *e = lz4_io_engine_init(queue_depth, iov, queue_depth * 2);
+  if (!e) {
+    aml_free(slots);
+    return -1;
+  }
+
+  lz4_set_content_size(l, size);
+  uint32_t header_size;
+  const char *header = lz4_get_header(l, &header_size);
+  bool ok = pwrite_fully(dest_fd, header, header_size, 0);
+  uint64_t offset = header_size;
+
+  /* block b is always read into slot b % queue_depth */
+  uint64_t next_read = 0;
+  while (next_read < num_blocks && next_read < (uint64_t)queue_depth) {
+    lz4_async_slot_t *s = slots + next_read;
+    uint64_t pos = next_read * block_size;
+    s->in_len = size - pos < block_size ? size - pos : block_size;
+    lz4_io_engine_submit(e, &s->read, src_fd, false, s->in, s->in_len, pos,
+                         next_read * 2);
+    next_read++;
+  }
+  for (uint64_t b = 0; ok && b < num_blocks; b++) {
+    int i = b % queue_depth;
+    lz4_async_slot_t *s = slots + i;
+    if (lz4_io_engine_wait(e, &s->read) != s->in_len ||
+        !wait_write(e, &s->write)) {
+      ok = false;
+      break;
+    }
+    uint32_t len =
+        lz4_compress_block(l, s->in, s->in_len, s->out, compressed_size);
+    lz4_io_engine_submit(e, &s->write, dest_fd, true, s->out, len, offset,
+                         i * 2 + 1);
+    offset += len;
+    /* the input buffer is free as soon as the block is compressed */
+    if (next_read < num_blocks) {
+      uint64_t pos = next_read * block_size;
+      s->in_len = size - pos < block_size ? size - pos : block_size;
+      lz4_io_engine_submit(e, &s->read, src_fd, false, s->in, s->in_len, pos,
+                           i * 2);
+      next_read++;
+    }
+  }
+  for (int i = 0; i < queue_depth; i++)
+    ok = wait_write(e, &slots[i].write) && ok;
+
+  if (ok) {
+    char tail[8];
+    int n = lz4_finish(l, tail);
+    ok = n >= 0 && pwrite_fully(dest_fd, tail, n, offset);
+    offset += n;
+    aml_buffer_t *seek_table = aml_buffer_init(256);
+    size_t seek_table_len = lz4_write_seek_table(l, seek_table);
+    ok = ok && pwrite_fully(dest_fd, aml_buffer_data(seek_table),
+                            seek_table_len, offset);
+    offset += seek_table_len;
+    aml_buffer_destroy(seek_table);
+    ok = ok && ftruncate(dest_fd, offset) == 0;
+  }
+  lz4_io_engine_destroy(e);
+  aml_free(slots);
+  return ok ? (int64_t)offset : -1;
+}
+
+typedef struct {
+  char *buf;
+  uint32_t len;
+  lz4_io_req_t req;
+} lz4_async_chunk_t;
+
+/* The compressed frame is read in fixed size chunks, queue_depth of them in
+   flight.  Blocks are decompressed straight from a chunk unless they span two
+   chunks, in which case they are copied to staging. */
+typedef struct {
+  lz4_io_engine_t *e;
+  int fd;
+  uint64_t file_size;
+  uint64_t start;
+  lz4_async_chunk_t *chunks;
+  int num_chunks;
+  uint32_t chunk_size;
+  uint64_t next_chunk;
+  uint64_t current;
+  bool current_ready;
+  uint32_t pos;
+  char *staging;
+} lz4_async_input_t;
+
+static void submit_chunk(lz4_async_input_t *in) {
+  int i = in->next_chunk % in->num_chunks;
+  lz4_async_chunk_t *c = in->chunks + i;
+  uint64_t offset = in->start + in->next_chunk * in->chunk_size;
+  c->len = 0;
+  if (offset < in->file_size)
+    c->len = in->file_size - offset < in->chunk_size
+                 ? in->file_size - offset
+                 : in->chunk_size;
+  memset(&c->req, 0, sizeof(c->req));
+  if (c->len)
+    lz4_io_engine_submit(in->e, &c->req, in->fd, false, c->buf, c->len,
+                         offset, i);
+  in->next_chunk++;
+}
+
+static lz4_async_chunk_t *current_chunk(lz4_async_input_t *in) {
+  lz4_async_chunk_t *c = in->chunks + (in->current % in->num_chunks);
+  if (!in->current_ready) {
+    if (lz4_io_engine_wait(in->e, &c->req) != c->len)
+      return NULL;
+    in->current_ready = true;
+  }
+  return c;
+}
+
+/* the current chunk is consumed, its buffer reads the chunk num_chunks
+   ahead */
+static lz4_async_chunk_t *advance_chunk(lz4_async_input_t *in) {
+  submit_chunk(in);
+  in->current++;
+  in->current_ready = false;
+  in->pos = 0;
+  return current_chunk(in);
+}
+
+/* returns the next len bytes of the frame, valid until the next call */
+static const char *input_bytes(lz4_async_input_t *in, uint32_t len) {
+  lz4_async_chunk_t *c = current_chunk(in);
+  if (!c)
+    return NULL;
+  if (!len)
+    return in->staging;
+  if (in->pos == c->len) {
+    if (c->len < in->chunk_size || !(c = advance_chunk(in)))
+      return NULL;
+  }
+  uint32_t avail = c->len - in->pos;
+  if (len <= avail) {
+    const char *p = c->buf + in->pos;
+    in->pos += len;
+    return p;
+  }
+  memcpy(in->staging, c->buf + in->pos, avail);
+  if (c->len < in->chunk_size || !(c = advance_chunk(in)) ||
+      c->len < len - avail)
+    return NULL;
+  memcpy(in->staging + avail, c->buf, len - avail);
+  in->pos = len - avail;
+  return in->staging;
+}
+
+typedef struct {
+  char *buf;
+  lz4_io_req_t write;
+} lz4_async_output_t;
+
+int64_t lz4_async_decompress(int src_fd, int dest_fd, int queue_depth) {
+  struct stat st;
+  char header[LZ4_MAX_HEADER_SIZE];
+  lz4_header_t h;
+  if (fstat(src_fd, &st))
+    return -1;
+  ssize_t header_len = pread(src_fd, header, sizeof(header), 0);
+  if (header_len <= 0 || !lz4_check_header(&h, header, header_len))
+    return -1;
+  lz4_t *l = lz4_init_decompress(header, h.header_size);
+  if (!l)
+    return -1;
+  if (queue_depth <= 0)
+    queue_depth = LZ4_ASYNC_QUEUE_DEPTH;
+
+  lz4_async_input_t in;
+  in.fd = src_fd;
+  in.file_size = st.st_size;
+  in.start = h.header_size;
+  in.num_chunks = queue_depth;
+  /* a block with its size word and checksum fits in a chunk */
+  in.chunk_size = lz4_compressed_size(l) + 4;
+  in.next_chunk = 0;
+  in.current = 0;
+  in.current_ready = false;
+  in.pos = 0;
+
+  size_t slot_size = in.chunk_size + h.block_size;
+  in.chunks = (lz4_async_chunk_t *)aml_malloc(
+      (sizeof(lz4_async_chunk_t) + sizeof(lz4_async_output_t) +
+       sizeof(struct iovec) * 2 + slot_size) *
+          queue_depth +
+      in.chunk_size);
+  lz4_async_output_t *outs = (lz4_async_output_t *)(in.chunks + queue_depth);
+  struct iovec *iov = (struct iovec *)(outs + queue_depth);
+  char *buffers = (char *)(iov + queue_depth * 2);
+  memset(outs, 0, sizeof(lz4_async_output_t) * queue_depth);
+  for (int i = 0; i < queue_depth; i++) {
+    in.chunks[i].buf = buffers + slot_size * i;
+    outs[i].buf = in.chunks[i].buf + in.chunk_size;
+    iov[i].iov_base = in.chunks[i].buf;
+    iov[i].iov_len = in.chunk_size;
+    iov[queue_depth + i].iov_base = outs[i].buf;
+    iov[queue_depth + i].iov_len = h.block_size;
+  }
+  in.staging = buffers + slot_size * queue_depth;
+  in.e = lz4_io_engine_init(queue_depth, iov, queue_depth * 2);
+  if (!in.e) {
+    aml_free(in.chunks);
+    lz4_destroy(l);
+    return -1;
+  }
+  for (int i = 0; i < queue_depth; i++)
+    submit_chunk(&in);
+
+  int64_t result = -1;
+  uint64_t offset = 0;
+  uint32_t block_header_size = lz4_block_header_size(l);
+  for (uint64_t b = 0;; b++) {
+    const char *p = input_bytes(&in, 4);
+    if (!p)
+      break;
+    uint32_t v = (uint8_t)p[0] | ((uint8_t)p[1] << 8) |
+                 ((uint8_t)p[2] << 16) | ((uint32_t)(uint8_t)p[3] << 24);
+    if (!v) {
+      p = input_bytes(&in, h.content_checksum ? 4 : 0);
+      if (p) {
+        int r = lz4_finish(l, (void *)p);
+        result = r == -500 ? -500 : (r < 0 ? -1 : (int64_t)offset);
+      }
+      break;
+    }
+    uint32_t len = v & 0x7FFFFFFFU;
+    if (len > h.block_size || !(p = input_bytes(&in, len + block_header_size)))
+      break;
+    int i = b % queue_depth;
+    lz4_async_output_t *o = outs + i;
+    if (!wait_write(in.e, &o->write))
+      break;
+    int r = lz4_decompress(l, p, len + block_header_size, o->buf,
+                           h.block_size, !(v & 0x80000000U));
+    if (r < 0) {
+      result = r == -500 ? -500 : -1;
+      break;
+    }
+    lz4_io_engine_submit(in.e, &o->write, dest_fd, true, o->buf, r, offset,
+                         queue_depth + i);
+    offset += r;
+  }
+  for (int i = 0; i < queue_depth; i++)
+    if (!wait_write(in.e, &outs[i].write) && result >= 0)
+      result = -1;
+  if (result >= 0 && ftruncate(dest_fd, offset))
+    result = -1;
+
+  lz4_io_engine_destroy(in.e);
+  aml_free(in.chunks);
+  lz4_destroy(l);
+  return result;
+}
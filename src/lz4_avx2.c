@@ -0,0 +1,72 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+
+/* A second build of the vendored lz4 and lz4hc for cpus with AVX2 and BMI2.
+   Every function in it is made static (LZ4LIB_VISIBILITY), so it doesn't
+   clash with the baseline build in lz4.c, and only the kernel table is
+   exported.  LZ4_AVX2_KERNELS enables 32 byte literal and match copies and
+   32 byte match length comparisons; BMI2 gives tzcnt/shlx/shrx throughout. */
+#if (defined(__x86_64__) || defined(_M_X64)) && defined(__GNUC__) &&        \
+    !defined(__AVX2__)
+#define LZ4_AVX2_BUILD
+#endif
+
+#ifdef LZ4_AVX2_BUILD
+#ifdef __clang__
+#pragma clang attribute push(__attribute__((target("avx2,bmi,bmi2"))),     \
+                             apply_to = function)
+#else
+#pragma GCC target("avx2,bmi,bmi2")
+#endif
+#pragma GCC diagnostic ignored "-Wunused-function"
+
+#define LZ4LIB_VISIBILITY static
+#define LZ4_PUBLISH_STATIC_FUNCTIONS
+#define LZ4_AVX2_KERNELS
+/* used by lz4hc.c, not declared in lz4.h.  lz4.c defines them without
+   LZ4LIB_VISIBILITY, these static declarations give the definitions
+   internal linkage. */
+#define LZ4_compress_fast_force lz4_avx2_compress_fast_force
+#define LZ4_compress_forceExtDict lz4_avx2_compress_forceExtDict
+#define LZ4_decompress_safe_forceExtDict lz4_avx2_decompress_safe_forceExtDict
+#define LZ4_STATIC_LINKING_ONLY
+#define LZ4_DISABLE_DEPRECATE_WARNINGS
+#include "impl/lz4.h"
+static int LZ4_compress_fast_force(const char *src, char *dst, int srcSize,
+                                   int dstCapacity, int acceleration);
+static int LZ4_compress_forceExtDict(LZ4_stream_t *LZ4_dict,
+                                     const char *source, char *dest,
+                                     int srcSize);
+static int LZ4_decompress_safe_forceExtDict(const char *source, char *dest,
+                                            int compressedSize,
+                                            int maxOutputSize,
+                                            const void *dictStart,
+                                            size_t dictSize);
+#include "impl/lz4.c"
+#include "impl/lz4hc.c"
+
+#ifdef __clang__
+#pragma clang attribute pop
+#endif
+#endif
+
+#include "lz4_kernels.h"
+
+#include <stddef.h>
+
+#ifdef LZ4_AVX2_BUILD
+static const lz4_kernels_t kernels = {
+    LZ4_decompress_safe,
+    LZ4_decompress_safe_usingDict,
+    LZ4_decompress_safe_continue,
+    LZ4_compress_fast_extState_fastReset,
+    LZ4_compress_fast_continue,
+    LZ4_compress_HC_extStateHC_fastReset,
+    LZ4_compress_HC_continue,
+    "avx2"};
+
+const lz4_kernels_t *lz4_avx2_kernels(void) { return &kernels; }
+#else
+const lz4_kernels_t *lz4_avx2_kernels(void) { return NULL; }
+#endif
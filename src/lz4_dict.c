@@ -0,0 +1,142 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "the-lz4-library/lz4_dict.h"
+
+#include "a-memory-library/aml_alloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Dictionary training is a simplified form of the cover algorithm.  Every
+   LZ4_DICT_D byte substring of the samples is hashed and counted once per
+   sample it occurs in.  The samples are divided into one epoch per segment
+   the dictionary can hold, and in each epoch the LZ4_DICT_SEGMENT byte window
+   with the highest score is selected.  Substrings which occur in a single
+   sample don't score, and the substrings of a selected segment are cleared so
+   that later segments cover different content. */
+#define LZ4_DICT_D 8
+#define LZ4_DICT_SEGMENT 128
+#define LZ4_DICT_HASH_LOG 20
+
+typedef struct {
+  const char *p;
+  uint64_t score;
+} lz4_dict_segment_t;
+
+static uint32_t dict_hash(const char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return (uint32_t)((v * 0x9E3779B185EBCA87ULL) >> (64 - LZ4_DICT_HASH_LOG));
+}
+
+static uint32_t dict_score(const uint32_t *counts, const char *p) {
+  uint32_t c = counts[dict_hash(p)];
+  return c > 1 ? c - 1 : 0;
+}
+
+/* finds the best window of s which starts in [first, last] */
+static void best_segment(const uint32_t *counts, const char *s, size_t first,
+                         size_t last, lz4_dict_segment_t *best) {
+  const size_t positions = LZ4_DICT_SEGMENT - LZ4_DICT_D + 1;
+  uint64_t score = 0;
+  for (size_t i = 0; i < positions; i++)
+    score += dict_score(counts, s + first + i);
+  for (size_t w = first;; w++) {
+    if (score > best->score) {
+      best->score = score;
+      best->p = s + w;
+    }
+    if (w == last)
+      break;
+    score -= dict_score(counts, s + w);
+    score += dict_score(counts, s + w + positions);
+  }
+}
+
+static int compare_segments(const void *a, const void *b) {
+  const lz4_dict_segment_t *sa = (const lz4_dict_segment_t *)a;
+  const lz4_dict_segment_t *sb = (const lz4_dict_segment_t *)b;
+  if (sa->score != sb->score)
+    return sa->score < sb->score ? -1 : 1;
+  return sa->p < sb->p ? -1 : (sa->p > sb->p ? 1 : 0);
+}
+
+size_t lz4_dict_train(aml_buffer_t *dest, const void *const *samples,
+                      const size_t *sample_sizes, size_t num_samples,
+                      size_t dict_capacity) {
+  if (dict_capacity > LZ4_DICT_MAX_SIZE)
+    dict_capacity = LZ4_DICT_MAX_SIZE;
+  size_t total = 0;
+  for (size_t i = 0; i < num_samples; i++)
+    total += sample_sizes[i];
+
+  /* everything fits, the most recent samples go last */
+  if (total <= dict_capacity) {
+    for (size_t i = 0; i < num_samples; i++)
+      aml_buffer_append(dest, samples[i], sample_sizes[i]);
+    return total;
+  }
+  size_t num_segments = dict_capacity / LZ4_DICT_SEGMENT;
+  if (!num_segments)
+    return 0;
+
+  const size_t table_size = (size_t)1 << LZ4_DICT_HASH_LOG;
+  uint32_t *counts = (uint32_t *)aml_malloc(sizeof(uint32_t) * table_size * 2);
+  uint32_t *seen = counts + table_size;
+  memset(counts, 0, sizeof(uint32_t) * table_size * 2);
+  for (size_t i = 0; i < num_samples; i++) {
+    const char *s = (const char *)samples[i];
+    for (size_t pos = 0; pos + LZ4_DICT_D <= sample_sizes[i]; pos++) {
+      uint32_t h = dict_hash(s + pos);
+      if (seen[h] != i + 1) {
+        seen[h] = i + 1;
+        counts[h]++;
+      }
+    }
+  }
+
+  lz4_dict_segment_t *segments = (lz4_dict_segment_t *)aml_malloc(
+      sizeof(lz4_dict_segment_t) * num_segments);
+  size_t selected = 0;
+  size_t epoch_size = total / num_segments;
+  size_t sample = 0, sample_start = 0;
+  for (size_t e = 0; e < num_segments; e++) {
+    size_t epoch_start = e * epoch_size;
+    size_t epoch_end = e + 1 == num_segments ? total : epoch_start + epoch_size;
+    lz4_dict_segment_t best = {NULL, 0};
+    while (sample < num_samples) {
+      size_t sample_end = sample_start + sample_sizes[sample];
+      size_t start = epoch_start > sample_start ? epoch_start : sample_start;
+      size_t end = epoch_end < sample_end ? epoch_end : sample_end;
+      /* windows start in the epoch and never cross a sample boundary */
+      if (start < end && sample_sizes[sample] >= LZ4_DICT_SEGMENT) {
+        size_t first = start - sample_start;
+        size_t last = end - sample_start - 1;
+        if (last > sample_sizes[sample] - LZ4_DICT_SEGMENT)
+          last = sample_sizes[sample] - LZ4_DICT_SEGMENT;
+        if (first <= last)
+          best_segment(counts, (const char *)samples[sample], first, last,
+                       &best);
+      }
+      if (sample_end > epoch_end)
+        break;
+      sample_start = sample_end;
+      sample++;
+    }
+    if (!best.p)
+      continue;
+    segments[selected++] = best;
+    for (size_t i = 0; i + LZ4_DICT_D <= LZ4_DICT_SEGMENT; i++)
+      counts[dict_hash(best.p + i)] = 0;
+  }
+
+  /* the highest scoring segments are placed at the end */
+  qsort(segments, selected, sizeof(lz4_dict_segment_t), compare_segments);
+  for (size_t i = 0; i < selected; i++)
+    aml_buffer_append(dest, segments[i].p, LZ4_DICT_SEGMENT);
+
+  aml_free(segments);
+  aml_free(counts);
+  return selected * LZ4_DICT_SEGMENT;
+}
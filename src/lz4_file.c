@@ -0,0 +1,240 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "the-lz4-library/lz4_file.h"
+#include "the-lz4-library/lz4_seekable.h"
+
+#include "a-memory-library/aml_alloc.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* consumed pages are released in steps of this size */
+#define LZ4_FILE_RELEASE_SIZE (16 * 1024 * 1024)
+#define LZ4_FILE_SLACK 1024
+
+typedef struct {
+  char *data;
+  size_t len;
+  /* data before this offset has been released */
+  size_t released;
+} lz4_mapping_t;
+
+static bool map_input(lz4_mapping_t *m, int fd) {
+  struct stat st;
+  m->data = NULL;
+  m->released = 0;
+  if (fstat(fd, &st))
+    return false;
+  m->len = st.st_size;
+  if (!m->len)
+    return true;
+  void *p = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED)
+    return false;
+  m->data = (char *)p;
+  madvise(p, m->len, MADV_SEQUENTIAL);
+  madvise(p, m->len, MADV_WILLNEED);
+  return true;
+}
+
+/* output is sized up front and written through the mapping */
+static bool map_output(lz4_mapping_t *m, int fd, size_t len) {
+  m->data = NULL;
+  m->len = len;
+  m->released = 0;
+  if (ftruncate(fd, len))
+    return false;
+  if (!len)
+    return true;
+  void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    return false;
+  m->data = (char *)p;
+  madvise(p, len, MADV_SEQUENTIAL);
+  return true;
+}
+
+/* releases the pages before pos (the data stays in the page cache) */
+static void release_mapping(lz4_mapping_t *m, size_t pos) {
+  if (pos - m->released < LZ4_FILE_RELEASE_SIZE)
+    return;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t end = pos & ~(page - 1);
+  madvise(m->data + m->released, end - m->released, MADV_DONTNEED);
+  m->released = end;
+}
+
+static void unmap(lz4_mapping_t *m) {
+  if (m->data)
+    munmap(m->data, m->len);
+}
+
+static bool write_fully(int fd, const void *data, size_t len) {
+  const char *p = (const char *)data;
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+int64_t lz4_compress_file(lz4_t *l, const char *src_path,
+                          const char *dest_path) {
+  int fd = open(src_path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  lz4_mapping_t in;
+  bool ok = map_input(&in, fd);
+  close(fd);
+  if (!ok)
+    return -1;
+  fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    unmap(&in);
+    return -1;
+  }
+
+  lz4_set_content_size(l, in.len);
+  uint32_t header_size;
+  const char *header = lz4_get_header(l, &header_size);
+  ok = write_fully(fd, header, header_size);
+  int64_t total = header_size;
+
+  uint32_t block_size = lz4_block_size(l);
+  uint32_t compressed_size = lz4_compressed_size(l);
+  char *out = (char *)aml_malloc(compressed_size);
+  for (size_t pos = 0; ok && pos < in.len; pos += block_size) {
+    uint32_t n = in.len - pos < block_size ? in.len - pos : block_size;
+    uint32_t len = lz4_compress_block(l, in.data + pos, n, out, compressed_size);
+    ok = write_fully(fd, out, len);
+    total += len;
+    release_mapping(&in, pos + n);
+  }
+  int n = lz4_finish(l, out);
+  ok = ok && n >= 0 && write_fully(fd, out, n);
+  total += n;
+  aml_free(out);
+
+  aml_buffer_t *seek_table = aml_buffer_init(256);
+  size_t seek_table_len = lz4_write_seek_table(l, seek_table);
+  ok = ok && write_fully(fd, aml_buffer_data(seek_table), seek_table_len);
+  total += seek_table_len;
+  aml_buffer_destroy(seek_table);
+
+  unmap(&in);
+  if (close(fd))
+    ok = false;
+  if (!ok) {
+    unlink(dest_path);
+    return -1;
+  }
+  return total;
+}
+
+int64_t lz4_decompress_file(const char *src_path, const char *dest_path) {
+  int fd = open(src_path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  lz4_mapping_t in;
+  bool ok = map_input(&in, fd);
+  close(fd);
+  if (!ok)
+    return -1;
+
+  lz4_header_t h;
+  uint32_t header_size = in.len < LZ4_MAX_HEADER_SIZE ? in.len : LZ4_MAX_HEADER_SIZE;
+  lz4_t *l = NULL;
+  if (lz4_check_header(&h, in.data, header_size))
+    l = lz4_init_decompress(in.data, h.header_size);
+  if (!l) {
+    unmap(&in);
+    return -1;
+  }
+  fd = open(dest_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    lz4_destroy(l);
+    unmap(&in);
+    return -1;
+  }
+
+  lz4_mapping_t out;
+  out.data = NULL;
+  out.len = 0;
+  char *buffer = NULL;
+  /* the content size comes from the file, the output is only sized from it
+     if src could decompress to that much (LZ4 expands at most 255 times),
+     otherwise the blocks are written as they are decompressed and the size
+     is checked at the end */
+  if (h.has_content_size &&
+      h.content_size <= (uint64_t)in.len * 255 + LZ4_FILE_SLACK)
+    ok = map_output(&out, fd, h.content_size);
+  else
+    buffer = (char *)aml_malloc(h.block_size);
+
+  int64_t result = -1;
+  size_t pos = h.header_size, out_len = 0;
+  uint32_t block_header_size = lz4_block_header_size(l);
+  while (ok) {
+    uint32_t v;
+    if (in.len - pos < 4)
+      break;
+    memcpy(&v, in.data + pos, 4);
+    pos += 4;
+    if (!v) {
+      if (in.len - pos < (h.content_checksum ? 4 : 0))
+        break;
+      int r = lz4_finish(l, in.data + pos);
+      if (r == -500)
+        result = -500;
+      else if (r >= 0 && (!h.has_content_size || out_len == h.content_size))
+        result = out_len;
+      break;
+    }
+    size_t n = (v & 0x7FFFFFFFU) + block_header_size;
+    if (n > in.len - pos)
+      break;
+    char *dest = buffer;
+    uint32_t dest_len = h.block_size;
+    if (!buffer) {
+      dest = out.data + out_len;
+      if (out.len - out_len < dest_len)
+        dest_len = out.len - out_len;
+    }
+    int r = lz4_decompress(l, in.data + pos, n, dest, dest_len,
+                           !(v & 0x80000000U));
+    if (r < 0) {
+      result = r == -500 ? -500 : -1;
+      break;
+    }
+    if (buffer)
+      ok = write_fully(fd, buffer, r);
+    pos += n;
+    out_len += r;
+    release_mapping(&in, pos);
+    if (!buffer)
+      release_mapping(&out, out_len);
+  }
+
+  if (buffer)
+    aml_free(buffer);
+  unmap(&out);
+  unmap(&in);
+  lz4_destroy(l);
+  if (close(fd))
+    result = result < 0 ? result : -1;
+  if (result < 0)
+    unlink(dest_path);
+  return result;
+}
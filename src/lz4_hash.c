@@ -0,0 +1,236 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "the-lz4-library/lz4_hash.h"
+
+#include "lz4_pool.h"
+
+/* xxh3.h is xxHash 0.8, included privately so that its symbols don't clash
+   with the older xxhash.c compiled into lz4.c.  On x86-64 builds without
+   -mavx2, the SSE2 kernel is the default and an AVX2 kernel is compiled
+   alongside it (the same way as xxHash's own xxh_x86dispatch.c). */
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(__AVX2__) &&       \
+    defined(__GNUC__)
+#define LZ4_HASH_DISPATCH
+#define XXH_X86DISPATCH
+#define XXH_DISPATCH_AVX2 1
+#define XXH_TARGET_AVX2 __attribute__((__target__("avx2")))
+#define XXH_TARGET_SSE2 __attribute__((__target__("sse2")))
+#include <immintrin.h>
+#endif
+#define XXH_INLINE_ALL
+#include "impl/xxh3.h"
+
+typedef XXH64_hash_t (*hash_long_64_f)(const void *XXH_RESTRICT, size_t,
+                                       XXH64_hash_t,
+                                       const xxh_u8 *XXH_RESTRICT, size_t);
+typedef XXH128_hash_t (*hash_long_128_f)(const void *XXH_RESTRICT, size_t,
+                                         XXH64_hash_t,
+                                         const void *XXH_RESTRICT, size_t);
+typedef void (*update_f)(XXH3_state_t *, const xxh_u8 *, size_t);
+
+typedef struct {
+  hash_long_64_f hash_long_64;
+  hash_long_128_f hash_long_128;
+  update_f update;
+  const char *name;
+} kernel_t;
+
+static void update_default(XXH3_state_t *state, const xxh_u8 *s,
+                           size_t len) {
+  XXH3_update(state, s, len, XXH3_accumulate, XXH3_scrambleAcc);
+}
+
+#ifdef LZ4_HASH_DISPATCH
+XXH_NO_INLINE XXH_TARGET_AVX2 XXH64_hash_t
+hash_long_64_avx2(const void *XXH_RESTRICT s, size_t len, XXH64_hash_t seed,
+                  const xxh_u8 *XXH_RESTRICT secret, size_t secret_len) {
+  (void)secret;
+  (void)secret_len;
+  return XXH3_hashLong_64b_withSeed_internal(s, len, seed,
+                                             XXH3_accumulate_avx2,
+                                             XXH3_scrambleAcc_avx2,
+                                             XXH3_initCustomSecret_avx2);
+}
+
+XXH_NO_INLINE XXH_TARGET_AVX2 XXH128_hash_t
+hash_long_128_avx2(const void *XXH_RESTRICT s, size_t len, XXH64_hash_t seed,
+                   const void *XXH_RESTRICT secret, size_t secret_len) {
+  (void)secret;
+  (void)secret_len;
+  return XXH3_hashLong_128b_withSeed_internal(s, len, seed,
+                                              XXH3_accumulate_avx2,
+                                              XXH3_scrambleAcc_avx2,
+                                              XXH3_initCustomSecret_avx2);
+}
+
+XXH_NO_INLINE XXH_TARGET_AVX2 void
+update_avx2(XXH3_state_t *state, const xxh_u8 *s, size_t len) {
+  XXH3_update(state, s, len, XXH3_accumulate_avx2, XXH3_scrambleAcc_avx2);
+}
+#endif
+
+static kernel_t kernel = {XXH3_hashLong_64b_withSeed,
+                          XXH3_hashLong_128b_withSeed, update_default,
+#if XXH_VECTOR == XXH_AVX512
+                          "avx512"
+#elif XXH_VECTOR == XXH_AVX2
+                          "avx2"
+#elif XXH_VECTOR == XXH_SSE2
+                          "sse2"
+#elif XXH_VECTOR == XXH_NEON
+                          "neon"
+#else
+                          "scalar"
+#endif
+};
+
+#ifdef LZ4_HASH_DISPATCH
+/* runs before main (and before any other thread could hash) */
+__attribute__((constructor)) static void select_kernel(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernel.hash_long_64 = hash_long_64_avx2;
+    kernel.hash_long_128 = hash_long_128_avx2;
+    kernel.update = update_avx2;
+    kernel.name = "avx2";
+  }
+}
+#endif
+
+uint64_t lz4_hash3_64(const void *s, size_t len, uint64_t seed) {
+  return XXH3_64bits_internal(s, len, seed, XXH3_kSecret,
+                              sizeof(XXH3_kSecret), kernel.hash_long_64);
+}
+
+static lz4_hash128_t to_hash128(XXH128_hash_t h) {
+  lz4_hash128_t r;
+  r.low = h.low64;
+  r.high = h.high64;
+  return r;
+}
+
+lz4_hash128_t lz4_hash3_128(const void *s, size_t len, uint64_t seed) {
+  return to_hash128(XXH3_128bits_internal(s, len, seed, XXH3_kSecret,
+                                          sizeof(XXH3_kSecret),
+                                          kernel.hash_long_128));
+}
+
+const char *lz4_hash3_kernel(void) { return kernel.name; }
+
+typedef struct {
+  lz4_pool_job_t job;
+  const char *src;
+  size_t len;
+  uint64_t seed;
+  /* leaves of this range of chunks */
+  xxh_u8 *leaves;
+} lz4_hash3_range_t;
+
+static void hash_range_cb(void *arg, int worker) {
+  (void)worker;
+  lz4_hash3_range_t *r = (lz4_hash3_range_t *)arg;
+  const char *p = r->src;
+  size_t len = r->len;
+  xxh_u8 *leaf = r->leaves;
+  do {
+    size_t n = len < LZ4_HASH3_TREE_CHUNK_SIZE ? len
+                                               : LZ4_HASH3_TREE_CHUNK_SIZE;
+    lz4_hash128_t h = lz4_hash3_128(p, n, r->seed);
+    XXH_writeLE64(leaf, h.low);
+    XXH_writeLE64(leaf + 8, h.high);
+    leaf += 16;
+    p += n;
+    len -= n;
+  } while (len);
+}
+
+uint64_t lz4_hash3_tree(const void *s, size_t len, uint64_t seed,
+                        int num_threads) {
+  size_t num_chunks = len ? (len - 1) / LZ4_HASH3_TREE_CHUNK_SIZE + 1 : 1;
+  size_t leaves_len = num_chunks * 16 + 8;
+  xxh_u8 *leaves = (xxh_u8 *)aml_malloc(leaves_len);
+  XXH_writeLE64(leaves + num_chunks * 16, len);
+
+  if (num_threads <= 0)
+    num_threads = lz4_pool_default_threads();
+  if ((size_t)num_threads > num_chunks)
+    num_threads = num_chunks;
+  /* without a pool (the threads couldn't be created) the caller hashes
+     everything */
+  lz4_pool_t *pool =
+      num_threads > 1 ? lz4_pool_init(num_threads - 1) : NULL;
+  if (!pool)
+    num_threads = 1;
+  lz4_hash3_range_t single;
+  lz4_hash3_range_t *ranges = &single;
+  if (num_threads > 1)
+    ranges = (lz4_hash3_range_t *)aml_malloc(sizeof(lz4_hash3_range_t) *
+                                             num_threads);
+
+  /* each thread hashes a contiguous range of chunks, the caller hashes the
+     first range */
+  for (int i = num_threads - 1; i >= 0; i--) {
+    size_t first = num_chunks * i / num_threads;
+    size_t last = num_chunks * (i + 1) / num_threads;
+    lz4_hash3_range_t *r = ranges + i;
+    r->src = (const char *)s + first * LZ4_HASH3_TREE_CHUNK_SIZE;
+    r->len = (last == num_chunks ? len : last * LZ4_HASH3_TREE_CHUNK_SIZE) -
+             first * LZ4_HASH3_TREE_CHUNK_SIZE;
+    r->seed = seed;
+    r->leaves = leaves + first * 16;
+    if (i)
+      lz4_pool_run(pool, &r->job, hash_range_cb, r);
+    else
+      hash_range_cb(r, 0);
+  }
+  if (pool) {
+    for (int i = 1; i < num_threads; i++)
+      lz4_pool_wait(pool, &ranges[i].job);
+    lz4_pool_destroy(pool);
+    aml_free(ranges);
+  }
+
+  uint64_t h = lz4_hash3_64(leaves, leaves_len, seed);
+  aml_free(leaves);
+  return h;
+}
+
+struct lz4_hash3_s {
+  /* aligned for the vector kernels, within the same allocation */
+  XXH3_state_t *state;
+};
+
+#ifdef _AML_DEBUG_
+lz4_hash3_t *_lz4_hash3_init(uint64_t seed, const char *caller) {
+  lz4_hash3_t *h = (lz4_hash3_t *)_aml_malloc_d(
+      caller, sizeof(lz4_hash3_t) + sizeof(XXH3_state_t) + 64, false);
+#else
+lz4_hash3_t *_lz4_hash3_init(uint64_t seed) {
+  lz4_hash3_t *h = (lz4_hash3_t *)aml_malloc(sizeof(lz4_hash3_t) +
+                                             sizeof(XXH3_state_t) + 64);
+#endif
+  uintptr_t p = (uintptr_t)(h + 1);
+  h->state = (XXH3_state_t *)((p + 63) & ~(uintptr_t)63);
+  XXH3_INITSTATE(h->state);
+  lz4_hash3_reset(h, seed);
+  return h;
+}
+
+void lz4_hash3_reset(lz4_hash3_t *h, uint64_t seed) {
+  XXH3_64bits_reset_withSeed(h->state, seed);
+}
+
+void lz4_hash3_update(lz4_hash3_t *h, const void *s, size_t len) {
+  kernel.update(h->state, (const xxh_u8 *)s, len);
+}
+
+uint64_t lz4_hash3_digest64(lz4_hash3_t *h) {
+  return XXH3_64bits_digest(h->state);
+}
+
+lz4_hash128_t lz4_hash3_digest128(lz4_hash3_t *h) {
+  return to_hash128(XXH3_128bits_digest(h->state));
+}
+
+void lz4_hash3_destroy(lz4_hash3_t *h) { aml_free(h); }
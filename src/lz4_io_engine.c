@@ -0,0 +1,213 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "lz4_io_engine.h"
+
+#include "a-memory-library/aml_alloc.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef LZ4_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/* the thread pool never needs more threads than this to keep a device busy */
+#define LZ4_IO_MAX_THREADS 16
+
+struct lz4_io_engine_s {
+#ifdef LZ4_HAVE_LIBURING
+  struct io_uring ring;
+  bool registered;
+  /* submissions which haven't completed */
+  int inflight;
+#endif
+  lz4_pool_t *pool;
+};
+
+static void transfer_cb(void *arg, int worker) {
+  (void)worker;
+  lz4_io_req_t *req = (lz4_io_req_t *)arg;
+  while (req->done_len < req->len) {
+    ssize_t n;
+    if (req->write)
+      n = pwrite(req->fd, req->buf + req->done_len, req->len - req->done_len,
+                 req->offset + req->done_len);
+    else
+      n = pread(req->fd, req->buf + req->done_len, req->len - req->done_len,
+                req->offset + req->done_len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      req->error = errno;
+      return;
+    }
+    if (n == 0)
+      return;
+    req->done_len += n;
+  }
+}
+
+#ifdef LZ4_HAVE_LIBURING
+/* queues the rest of req.  If the ring has no free entry even after
+   submitting, the rest is transferred on the calling thread instead. */
+static void uring_queue(lz4_io_engine_t *e, lz4_io_req_t *req) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&e->ring);
+  if (!sqe) {
+    io_uring_submit(&e->ring);
+    sqe = io_uring_get_sqe(&e->ring);
+    if (!sqe) {
+      transfer_cb(req, 0);
+      req->done = true;
+      return;
+    }
+  }
+  char *buf = req->buf + req->done_len;
+  unsigned len = req->len - req->done_len;
+  uint64_t offset = req->offset + req->done_len;
+  if (req->buf_index >= 0) {
+    if (req->write)
+      io_uring_prep_write_fixed(sqe, req->fd, buf, len, offset,
+                                req->buf_index);
+    else
+      io_uring_prep_read_fixed(sqe, req->fd, buf, len, offset,
+                               req->buf_index);
+  } else {
+    if (req->write)
+      io_uring_prep_write(sqe, req->fd, buf, len, offset);
+    else
+      io_uring_prep_read(sqe, req->fd, buf, len, offset);
+  }
+  io_uring_sqe_set_data(sqe, req);
+  io_uring_submit(&e->ring);
+  e->inflight++;
+}
+
+/* reaps one completion, short transfers are resubmitted.  Returns 0 or the
+   error of io_uring_wait_cqe (-EINTR is retried by the caller). */
+static int uring_reap(lz4_io_engine_t *e) {
+  struct io_uring_cqe *cqe;
+  int r = io_uring_wait_cqe(&e->ring, &cqe);
+  if (r < 0)
+    return r;
+  lz4_io_req_t *req = (lz4_io_req_t *)io_uring_cqe_get_data(cqe);
+  int res = cqe->res;
+  io_uring_cqe_seen(&e->ring, cqe);
+  e->inflight--;
+  if (res == -EINTR || res == -EAGAIN) {
+    uring_queue(e, req);
+    return 0;
+  }
+  if (res < 0)
+    req->error = -res;
+  else {
+    req->done_len += res;
+    if (res > 0 && req->done_len < req->len) {
+      uring_queue(e, req);
+      return 0;
+    }
+  }
+  req->done = true;
+  return 0;
+}
+#endif
+
+lz4_io_engine_t *lz4_io_engine_init(int queue_depth,
+                                    const struct iovec *buffers,
+                                    int num_buffers) {
+  lz4_io_engine_t *e = (lz4_io_engine_t *)aml_malloc(sizeof(lz4_io_engine_t));
+  e->pool = NULL;
+#ifdef LZ4_HAVE_LIBURING
+  e->inflight = 0;
+  /* every buffer has at most one request in flight */
+  unsigned entries = num_buffers + queue_depth + 2;
+  if (io_uring_queue_init(entries, &e->ring, 0) == 0) {
+    /* registering fails if the buffers can't be locked in memory, requests
+       then fall back to unregistered reads and writes */
+    e->registered =
+        num_buffers &&
+        io_uring_register_buffers(&e->ring, buffers, num_buffers) == 0;
+    return e;
+  }
+#else
+  (void)buffers;
+  (void)num_buffers;
+#endif
+  int threads = queue_depth < LZ4_IO_MAX_THREADS ? queue_depth
+                                                 : LZ4_IO_MAX_THREADS;
+  e->pool = lz4_pool_init(threads > 0 ? threads : 1);
+  if (!e->pool) {
+    aml_free(e);
+    return NULL;
+  }
+  return e;
+}
+
+bool lz4_io_engine_uring(lz4_io_engine_t *e) { return !e->pool; }
+
+void lz4_io_engine_submit(lz4_io_engine_t *e, lz4_io_req_t *req, int fd,
+                          bool write, char *buf, size_t len,
+                          uint64_t offset, int buf_index) {
+  req->fd = fd;
+  req->write = write;
+  req->buf = buf;
+  req->len = len;
+  req->offset = offset;
+  req->buf_index = buf_index;
+  req->done_len = 0;
+  req->error = 0;
+  req->done = false;
+  req->pending = true;
+  if (e->pool) {
+    lz4_pool_run(e->pool, &req->job, transfer_cb, req);
+    return;
+  }
+#ifdef LZ4_HAVE_LIBURING
+  if (!e->registered)
+    req->buf_index = -1;
+  uring_queue(e, req);
+#endif
+}
+
+int64_t lz4_io_engine_wait(lz4_io_engine_t *e, lz4_io_req_t *req) {
+  if (req->pending) {
+    if (e->pool)
+      lz4_pool_wait(e->pool, &req->job);
+#ifdef LZ4_HAVE_LIBURING
+    else
+      while (!req->done) {
+        int r = uring_reap(e);
+        /* the ring can't be waited on, so req will never complete */
+        if (r < 0 && r != -EINTR) {
+          req->error = -r;
+          req->done = true;
+        }
+      }
+#endif
+    req->pending = false;
+  }
+  return req->error ? -1 : (int64_t)req->done_len;
+}
+
+void lz4_io_engine_destroy(lz4_io_engine_t *e) {
+  if (e->pool)
+    lz4_pool_destroy(e->pool);
+#ifdef LZ4_HAVE_LIBURING
+  else {
+    /* requests which were never waited for must complete before their
+       buffers go away */
+    struct io_uring_cqe *cqe;
+    while (e->inflight > 0) {
+      int r = io_uring_wait_cqe(&e->ring, &cqe);
+      if (r == -EINTR)
+        continue;
+      if (r < 0)
+        break;
+      io_uring_cqe_seen(&e->ring, cqe);
+      e->inflight--;
+    }
+    io_uring_queue_exit(&e->ring);
+  }
+#endif
+  aml_free(e);
+}
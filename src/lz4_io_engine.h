@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_io_engine_H
+#define _lz4_io_engine_H
+
+/* Asynchronous positioned reads and writes used internally by the file
+   pipelines in lz4_async.c.  With LZ4_HAVE_LIBURING, requests go through an
+   io_uring with the pipeline's buffers registered.  Without it (or if the
+   kernel refuses to create a ring), a pool of threads runs pread/pwrite.
+   Requests always transfer their full length unless the end of the file is
+   reached or an error occurs. */
+
+#include "lz4_pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+struct lz4_io_engine_s;
+typedef struct lz4_io_engine_s lz4_io_engine_t;
+
+typedef struct {
+  lz4_pool_job_t job;
+  int fd;
+  bool write;
+  char *buf;
+  size_t len;
+  uint64_t offset;
+  /* index of the registered buffer holding buf or -1 */
+  int buf_index;
+  size_t done_len;
+  int error;
+  bool done;
+  bool pending;
+} lz4_io_req_t;
+
+/* buffers are registered with the ring (if there is one), requests on them
+   should set buf_index */
+lz4_io_engine_t *lz4_io_engine_init(int queue_depth,
+                                    const struct iovec *buffers,
+                                    int num_buffers);
+
+/* true if requests go through io_uring */
+bool lz4_io_engine_uring(lz4_io_engine_t *e);
+
+void lz4_io_engine_submit(lz4_io_engine_t *e, lz4_io_req_t *req, int fd,
+                          bool write, char *buf, size_t len,
+                          uint64_t offset, int buf_index);
+
+/* waits for req (if it is pending) and returns the number of bytes
+   transferred or -1 on error */
+int64_t lz4_io_engine_wait(lz4_io_engine_t *e, lz4_io_req_t *req);
+
+/* waits for pending requests before freeing e */
+void lz4_io_engine_destroy(lz4_io_engine_t *e);
+
+#endif
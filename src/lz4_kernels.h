@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_kernels_H
+#define _lz4_kernels_H
+
+/* The block compressors and decompressors used by lz4.c.  The vendored lz4
+   is compiled once for the baseline cpu (in lz4.c) and, on x86-64, a second
+   time with AVX2 and BMI2 enabled (in lz4_avx2.c).  lz4.c selects one set
+   when the library is loaded. */
+
+#define LZ4_HC_STATIC_LINKING_ONLY
+#include "impl/lz4hc.h"
+
+typedef struct {
+  int (*decompress_safe)(const char *src, char *dst, int src_size,
+                         int dst_capacity);
+  int (*decompress_safe_using_dict)(const char *src, char *dst, int src_size,
+                                    int dst_capacity, const char *dict,
+                                    int dict_size);
+  int (*decompress_safe_continue)(LZ4_streamDecode_t *stream,
+                                  const char *src, char *dst, int src_size,
+                                  int dst_capacity);
+  int (*compress_fast_ext_state_fast_reset)(void *state, const char *src,
+                                            char *dst, int src_size,
+                                            int dst_capacity,
+                                            int acceleration);
+  int (*compress_fast_continue)(LZ4_stream_t *stream, const char *src,
+                                char *dst, int src_size, int dst_capacity,
+                                int acceleration);
+  int (*compress_hc_ext_state_fast_reset)(void *state, const char *src,
+                                          char *dst, int src_size,
+                                          int dst_capacity, int level);
+  int (*compress_hc_continue)(LZ4_streamHC_t *stream, const char *src,
+                              char *dst, int src_size, int dst_capacity);
+  const char *name;
+} lz4_kernels_t;
+
+/* NULL if the library wasn't built with the AVX2 kernels */
+const lz4_kernels_t *lz4_avx2_kernels(void);
+
+#endif
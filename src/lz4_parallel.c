@@ -0,0 +1,385 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "the-lz4-library/lz4_parallel.h"
+
+#include "lz4_pool.h"
+
+#include "a-memory-library/aml_alloc.h"
+
+#include <string.h>
+
+typedef struct {
+  lz4_pool_job_t job;
+  lz4_parallel_t *p;
+  const char *src;
+  uint32_t src_len;
+  char *in; /* holds the input of blocks which were copied */
+  char *out;
+  uint32_t out_len;
+} lz4_parallel_block_t;
+
+struct lz4_parallel_s {
+  int level;
+  lz4_block_size_t size;
+  bool block_checksum;
+  bool content_checksum;
+
+  lz4_pool_t *pool;
+  /* frame provides the header, content checksum and end mark, the workers
+     compress blocks and have no content checksum */
+  lz4_t *frame;
+  lz4_t **workers;
+  int num_workers;
+
+  uint32_t block_size;
+  uint32_t compressed_size;
+
+  lz4_parallel_block_t *blocks;
+  uint32_t window;
+  uint32_t head;
+  uint32_t pending;
+
+  char *partial;
+  uint32_t partial_len;
+  bool started;
+};
+
+/* the frame context never compresses, so it uses the small fast stream */
+static lz4_t *init_frame(lz4_parallel_t *p) {
+  return lz4_init(1, p->size, p->block_checksum, p->content_checksum);
+}
+
+static void compress_block_cb(void *arg, int worker) {
+  lz4_parallel_block_t *b = (lz4_parallel_block_t *)arg;
+  lz4_parallel_t *p = b->p;
+  b->out_len = lz4_compress_block(p->workers[worker], b->src, b->src_len,
+                                  b->out, p->compressed_size);
+}
+
+static void retire_block(lz4_parallel_t *p, aml_buffer_t *dest) {
+  lz4_parallel_block_t *b = p->blocks + p->head;
+  lz4_pool_wait(p->pool, &b->job);
+  aml_buffer_append(dest, b->out, b->out_len);
+  p->head++;
+  if (p->head == p->window)
+    p->head = 0;
+  p->pending--;
+}
+
+static void drain(lz4_parallel_t *p, aml_buffer_t *dest) {
+  while (p->pending)
+    retire_block(p, dest);
+}
+
+static void submit_block(lz4_parallel_t *p, aml_buffer_t *dest,
+                         const char *src, uint32_t len, bool copy) {
+  if (p->pending == p->window)
+    retire_block(p, dest);
+  uint32_t slot = p->head + p->pending;
+  if (slot >= p->window)
+    slot -= p->window;
+  lz4_parallel_block_t *b = p->blocks + slot;
+  if (copy) {
+    if (!b->in)
+      b->in = (char *)aml_malloc(p->block_size);
+    memcpy(b->in, src, len);
+    src = b->in;
+  }
+  b->src = src;
+  b->src_len = len;
+  p->pending++;
+  lz4_pool_run(p->pool, &b->job, compress_block_cb, b);
+  /* the content checksum overlaps with the workers */
+  if (p->content_checksum)
+    lz4_update_content_checksum(p->frame, src, len);
+}
+
+static void start_frame(lz4_parallel_t *p, aml_buffer_t *dest) {
+  uint32_t header_size;
+  const char *header = lz4_get_header(p->frame, &header_size);
+  aml_buffer_append(dest, header, header_size);
+  p->started = true;
+}
+
+void lz4_parallel_write(lz4_parallel_t *p, aml_buffer_t *dest,
+                        const void *src, size_t src_len) {
+  const char *srcp = (const char *)src;
+  if (!p->started)
+    start_frame(p, dest);
+  if (p->partial_len) {
+    uint32_t n = p->block_size - p->partial_len;
+    if (n > src_len)
+      n = src_len;
+    memcpy(p->partial + p->partial_len, srcp, n);
+    p->partial_len += n;
+    srcp += n;
+    src_len -= n;
+    if (p->partial_len == p->block_size) {
+      submit_block(p, dest, p->partial, p->block_size, true);
+      p->partial_len = 0;
+    }
+  }
+  /* only the last window blocks can still be pending when this returns, so
+     they are copied and the ones before them are compressed in place.  A
+     caller writing a block at a time keeps the workers busy. */
+  size_t num_blocks = src_len / p->block_size;
+  for (size_t i = 0; i < num_blocks; i++) {
+    submit_block(p, dest, srcp, p->block_size, i + p->window >= num_blocks);
+    srcp += p->block_size;
+    src_len -= p->block_size;
+  }
+  if (src_len) {
+    memcpy(p->partial, srcp, src_len);
+    p->partial_len = src_len;
+  }
+}
+
+void lz4_parallel_finish(lz4_parallel_t *p, aml_buffer_t *dest) {
+  if (!p->started)
+    start_frame(p, dest);
+  if (p->partial_len) {
+    submit_block(p, dest, p->partial, p->partial_len, true);
+    p->partial_len = 0;
+  }
+  drain(p, dest);
+  char end[8];
+  int n = lz4_finish(p->frame, end);
+  aml_buffer_append(dest, end, n);
+
+  /* the content checksum can't be reset, so start over with a new frame */
+  lz4_destroy(p->frame);
+  p->frame = init_frame(p);
+  p->started = false;
+}
+
+size_t lz4_parallel_compress(lz4_parallel_t *p, aml_buffer_t *dest,
+                             const void *src, size_t src_len) {
+  size_t olen = aml_buffer_length(dest);
+  lz4_parallel_write(p, dest, src, src_len);
+  lz4_parallel_finish(p, dest);
+  return aml_buffer_length(dest) - olen;
+}
+
+int lz4_parallel_threads(lz4_parallel_t *p) { return p->num_workers; }
+
+typedef struct {
+  lz4_pool_job_t job;
+  lz4_t *d;
+  const char *src;
+  uint32_t src_len;
+  bool compressed;
+  char *dest;
+  uint32_t dest_len;
+  int result;
+} lz4_parallel_dblock_t;
+
+static void decompress_block_cb(void *arg, int worker) {
+  (void)worker;
+  lz4_parallel_dblock_t *b = (lz4_parallel_dblock_t *)arg;
+  b->result = lz4_decompress_independent(b->d, b->src, b->src_len, b->dest,
+                                         b->dest_len, b->compressed);
+}
+
+static uint32_t read_block_word(const char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/* walks the block size words of the frame, fills blocks (if not NULL) and
+   returns the number of blocks or -1 if the frame is truncated */
+static int64_t scan_blocks(lz4_t *d, const char *src, size_t src_len,
+                           size_t pos, lz4_parallel_dblock_t *blocks,
+                           size_t *end) {
+  uint32_t block_header_size = lz4_block_header_size(d);
+  int64_t num_blocks = 0;
+  while (true) {
+    if (pos + sizeof(uint32_t) > src_len)
+      return -1;
+    uint32_t v = read_block_word(src + pos);
+    pos += sizeof(uint32_t);
+    if (!v)
+      break;
+    uint32_t len = (v & 0x7FFFFFFFU) + block_header_size;
+    if (len > src_len - pos)
+      return -1;
+    if (blocks) {
+      lz4_parallel_dblock_t *b = blocks + num_blocks;
+      b->d = d;
+      b->src = src + pos;
+      b->src_len = len;
+      b->compressed = !(v & 0x80000000U);
+    }
+    num_blocks++;
+    pos += len;
+  }
+  *end = pos;
+  return num_blocks;
+}
+
+#define LZ4_PARALLEL_SLACK 1024
+
+int64_t lz4_parallel_decompress(aml_buffer_t *dest, const void *src,
+                                size_t src_len, int num_threads) {
+  const char *srcp = (const char *)src;
+  lz4_header_t h;
+  uint32_t header_len = src_len < LZ4_MAX_HEADER_SIZE ? src_len
+                                                      : LZ4_MAX_HEADER_SIZE;
+  if (!lz4_check_header(&h, (void *)srcp, header_len) || h.linked_blocks)
+    return -1;
+  lz4_t *d = lz4_init_decompress((void *)srcp, h.header_size);
+  if (!d)
+    return -1;
+
+  size_t end;
+  int64_t num_blocks =
+      scan_blocks(d, srcp, src_len, h.header_size, NULL, &end);
+  if (num_blocks < 0 ||
+      (h.content_checksum && end + sizeof(uint32_t) > src_len)) {
+    lz4_destroy(d);
+    return -1;
+  }
+
+  /* every block but the last decompresses to a full block, so each one can
+     be written directly to its place in dest.  With a content size the output
+     is allocated exactly. */
+  uint64_t out_len = num_blocks * (uint64_t)h.block_size;
+  if (h.has_content_size) {
+    if (h.content_size > out_len ||
+        (num_blocks && h.content_size <= out_len - h.block_size)) {
+      lz4_destroy(d);
+      return -1;
+    }
+    out_len = h.content_size;
+  }
+  /* a block of a few bytes can claim a full block (up to 4MB), so the output
+     is limited to what src could decompress to before it is allocated (LZ4
+     expands at most 255 times, the slack covers the smallest inputs) */
+  if (out_len > (uint64_t)src_len * 255 + LZ4_PARALLEL_SLACK) {
+    lz4_destroy(d);
+    return -1;
+  }
+
+  lz4_parallel_dblock_t *blocks = (lz4_parallel_dblock_t *)aml_malloc(
+      sizeof(lz4_parallel_dblock_t) * (num_blocks + 1));
+  scan_blocks(d, srcp, src_len, h.header_size, blocks, &end);
+
+  size_t olen = aml_buffer_length(dest);
+  char *out = (char *)aml_buffer_append_ualloc(dest, out_len);
+  lz4_pool_t *pool = num_blocks > 1 ? lz4_pool_init(num_threads) : NULL;
+  for (int64_t i = 0; i < num_blocks; i++) {
+    lz4_parallel_dblock_t *b = blocks + i;
+    b->dest = out + i * h.block_size;
+    b->dest_len = i + 1 < num_blocks ? h.block_size
+                                     : out_len - i * h.block_size;
+    if (pool)
+      lz4_pool_run(pool, &b->job, decompress_block_cb, b);
+    else
+      decompress_block_cb(b, 0);
+  }
+
+  /* the content checksum is updated in order as blocks finish */
+  int64_t result = 0;
+  for (int64_t i = 0; i < num_blocks; i++) {
+    lz4_parallel_dblock_t *b = blocks + i;
+    if (pool)
+      lz4_pool_wait(pool, &b->job);
+    if (result < 0)
+      continue;
+    if (b->result < 0)
+      result = b->result;
+    else if (i + 1 < num_blocks && (uint32_t)b->result != h.block_size)
+      result = -1;
+    else {
+      lz4_update_content_checksum(d, b->dest, b->result);
+      result += b->result;
+    }
+  }
+  if (pool)
+    lz4_pool_destroy(pool);
+  if (result >= 0 && h.has_content_size && (uint64_t)result != out_len)
+    result = -1;
+  if (result >= 0 && lz4_finish(d, (void *)(srcp + end)) < 0)
+    result = -500;
+  aml_buffer_resize(dest, result >= 0 ? olen + result : olen);
+
+  aml_free(blocks);
+  lz4_destroy(d);
+  return result;
+}
+
+#ifdef _AML_DEBUG_
+lz4_parallel_t *_lz4_parallel_init(int level, lz4_block_size_t size,
+                                   bool block_checksum, bool content_checksum,
+                                   int num_threads, const char *caller) {
+#else
+lz4_parallel_t *_lz4_parallel_init(int level, lz4_block_size_t size,
+                                   bool block_checksum, bool content_checksum,
+                                   int num_threads) {
+#endif
+  lz4_pool_t *pool = lz4_pool_init(num_threads);
+  if (!pool)
+    return NULL;
+  num_threads = lz4_pool_threads(pool);
+  uint32_t window = num_threads * 2;
+
+#ifdef _AML_DEBUG_
+  lz4_parallel_t *p = (lz4_parallel_t *)_aml_malloc_d(
+      caller,
+      sizeof(lz4_parallel_t) + sizeof(lz4_t *) * num_threads +
+          sizeof(lz4_parallel_block_t) * window,
+      false);
+#else
+  lz4_parallel_t *p = (lz4_parallel_t *)aml_malloc(
+      sizeof(lz4_parallel_t) + sizeof(lz4_t *) * num_threads +
+      sizeof(lz4_parallel_block_t) * window);
+#endif
+  p->level = level;
+  p->size = size;
+  p->block_checksum = block_checksum;
+  p->content_checksum = content_checksum;
+  p->pool = pool;
+  p->frame = init_frame(p);
+  if (!p->frame) {
+    lz4_pool_destroy(pool);
+    aml_free(p);
+    return NULL;
+  }
+  p->block_size = lz4_block_size(p->frame);
+  p->compressed_size = lz4_compressed_size(p->frame);
+
+  p->workers = (lz4_t **)(p + 1);
+  p->num_workers = num_threads;
+  for (int i = 0; i < num_threads; i++)
+    p->workers[i] = lz4_init(level, size, block_checksum, false);
+
+  p->blocks = (lz4_parallel_block_t *)(p->workers + num_threads);
+  p->window = window;
+  p->head = 0;
+  p->pending = 0;
+  for (uint32_t i = 0; i < window; i++) {
+    p->blocks[i].p = p;
+    p->blocks[i].in = NULL;
+    p->blocks[i].out = (char *)aml_malloc(p->compressed_size);
+  }
+  p->partial = (char *)aml_malloc(p->block_size);
+  p->partial_len = 0;
+  p->started = false;
+  return p;
+}
+
+void lz4_parallel_destroy(lz4_parallel_t *p) {
+  /* workers may still reference blocks */
+  lz4_pool_destroy(p->pool);
+  for (uint32_t i = 0; i < p->window; i++) {
+    if (p->blocks[i].in)
+      aml_free(p->blocks[i].in);
+    aml_free(p->blocks[i].out);
+  }
+  for (int i = 0; i < p->num_workers; i++)
+    lz4_destroy(p->workers[i]);
+  lz4_destroy(p->frame);
+  aml_free(p->partial);
+  aml_free(p);
+}
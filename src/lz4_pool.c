@@ -0,0 +1,121 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "lz4_pool.h"
+
+#include "a-memory-library/aml_alloc.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct {
+  lz4_pool_t *pool;
+  int id;
+  pthread_t thread;
+} lz4_pool_worker_t;
+
+struct lz4_pool_s {
+  pthread_mutex_t mutex;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  lz4_pool_job_t *head;
+  lz4_pool_job_t *tail;
+  bool shutdown;
+  int num_threads;
+  lz4_pool_worker_t *workers;
+};
+
+int lz4_pool_default_threads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+static void *lz4_pool_worker(void *arg) {
+  lz4_pool_worker_t *w = (lz4_pool_worker_t *)arg;
+  lz4_pool_t *p = w->pool;
+  pthread_mutex_lock(&p->mutex);
+  while (true) {
+    while (!p->head && !p->shutdown)
+      pthread_cond_wait(&p->work, &p->mutex);
+    if (!p->head)
+      break;
+    lz4_pool_job_t *job = p->head;
+    p->head = job->next;
+    if (!p->head)
+      p->tail = NULL;
+    pthread_mutex_unlock(&p->mutex);
+
+    job->cb(job->arg, w->id);
+
+    pthread_mutex_lock(&p->mutex);
+    job->done = true;
+    pthread_cond_broadcast(&p->done);
+  }
+  pthread_mutex_unlock(&p->mutex);
+  return NULL;
+}
+
+lz4_pool_t *lz4_pool_init(int num_threads) {
+  if (num_threads <= 0)
+    num_threads = lz4_pool_default_threads();
+  lz4_pool_t *p = (lz4_pool_t *)aml_malloc(
+      sizeof(lz4_pool_t) + sizeof(lz4_pool_worker_t) * num_threads);
+  pthread_mutex_init(&p->mutex, NULL);
+  pthread_cond_init(&p->work, NULL);
+  pthread_cond_init(&p->done, NULL);
+  p->head = p->tail = NULL;
+  p->shutdown = false;
+  p->workers = (lz4_pool_worker_t *)(p + 1);
+  p->num_threads = 0;
+  for (int i = 0; i < num_threads; i++) {
+    lz4_pool_worker_t *w = p->workers + p->num_threads;
+    w->pool = p;
+    w->id = p->num_threads;
+    if (pthread_create(&w->thread, NULL, lz4_pool_worker, w) != 0)
+      break;
+    p->num_threads++;
+  }
+  if (!p->num_threads) {
+    lz4_pool_destroy(p);
+    return NULL;
+  }
+  return p;
+}
+
+int lz4_pool_threads(lz4_pool_t *p) { return p->num_threads; }
+
+void lz4_pool_run(lz4_pool_t *p, lz4_pool_job_t *job, lz4_pool_cb cb,
+                  void *arg) {
+  job->cb = cb;
+  job->arg = arg;
+  job->done = false;
+  job->next = NULL;
+  pthread_mutex_lock(&p->mutex);
+  if (p->tail)
+    p->tail->next = job;
+  else
+    p->head = job;
+  p->tail = job;
+  pthread_cond_signal(&p->work);
+  pthread_mutex_unlock(&p->mutex);
+}
+
+void lz4_pool_wait(lz4_pool_t *p, lz4_pool_job_t *job) {
+  pthread_mutex_lock(&p->mutex);
+  while (!job->done)
+    pthread_cond_wait(&p->done, &p->mutex);
+  pthread_mutex_unlock(&p->mutex);
+}
+
+void lz4_pool_destroy(lz4_pool_t *p) {
+  pthread_mutex_lock(&p->mutex);
+  p->shutdown = true;
+  pthread_cond_broadcast(&p->work);
+  pthread_mutex_unlock(&p->mutex);
+  for (int i = 0; i < p->num_threads; i++)
+    pthread_join(p->workers[i].thread, NULL);
+  pthread_cond_destroy(&p->done);
+  pthread_cond_destroy(&p->work);
+  pthread_mutex_destroy(&p->mutex);
+  aml_free(p);
+}
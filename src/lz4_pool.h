@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#ifndef _lz4_pool_H
+#define _lz4_pool_H
+
+/* A small fixed-size worker pool used internally by the multi-threaded frame
+   routines.  Jobs are run in the order they are submitted, each callback is
+   given the index of the worker running it so that callers can keep per-worker
+   state (such as one lz4_t per worker). */
+
+#include <stdbool.h>
+
+typedef void (*lz4_pool_cb)(void *arg, int worker);
+
+typedef struct lz4_pool_job_s {
+  lz4_pool_cb cb;
+  void *arg;
+  bool done;
+  struct lz4_pool_job_s *next;
+} lz4_pool_job_t;
+
+struct lz4_pool_s;
+typedef struct lz4_pool_s lz4_pool_t;
+
+/* number of online cpus, at least 1 */
+int lz4_pool_default_threads(void);
+
+/* num_threads <= 0 uses lz4_pool_default_threads() */
+lz4_pool_t *lz4_pool_init(int num_threads);
+
+int lz4_pool_threads(lz4_pool_t *p);
+
+/* job must stay valid until lz4_pool_wait returns for it */
+void lz4_pool_run(lz4_pool_t *p, lz4_pool_job_t *job, lz4_pool_cb cb,
+                  void *arg);
+
+void lz4_pool_wait(lz4_pool_t *p, lz4_pool_job_t *job);
+
+/* waits for queued jobs to finish before joining the workers */
+void lz4_pool_destroy(lz4_pool_t *p);
+
+#endif
@@ -0,0 +1,323 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "the-lz4-library/lz4_reader.h"
+
+#include "a-memory-library/aml_alloc.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LZ4_READER_SLOTS 2
+
+enum {
+  SLOT_EMPTY,
+  SLOT_LOADED,  /* compressed block is ready */
+  SLOT_BUSY,    /* being decompressed by the helper or the caller */
+  SLOT_DECODED, /* out holds the block */
+  SLOT_END,     /* end mark, compressed holds the content checksum */
+  SLOT_ERROR
+};
+
+typedef struct {
+  int state;
+  /* owned for fds, points into the source for memory */
+  const char *compressed;
+  uint32_t compressed_len;
+  bool stored;
+  char *buffer;
+  /* the decoded block, stored blocks are not copied out of compressed */
+  const char *out;
+  int out_len;
+} lz4_reader_slot_t;
+
+struct lz4_reader_s {
+  int fd;
+  const char *src;
+  size_t src_len;
+  size_t src_pos;
+
+  lz4_t *l;
+  lz4_header_t h;
+  char header_buf[LZ4_MAX_HEADER_SIZE];
+
+  lz4_reader_slot_t slots[LZ4_READER_SLOTS];
+  /* head is the slot the caller reads from, tail the next slot to load */
+  uint32_t head;
+  uint32_t tail;
+  /* position within the head slot once it is decoded */
+  int pos;
+  bool loaded_end;
+  /* the helper only decompresses ahead while the caller does small reads */
+  bool read_ahead;
+  bool stop;
+  int error;
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+/* reads len bytes from the source, returns false at the end of it */
+static bool read_source(lz4_reader_t *r, void *dest, size_t len) {
+  if (!r->src) {
+    char *p = (char *)dest;
+    while (len) {
+      ssize_t n = read(r->fd, p, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+  if (len > r->src_len - r->src_pos)
+    return false;
+  memcpy(dest, r->src + r->src_pos, len);
+  r->src_pos += len;
+  return true;
+}
+
+/* points the slot at the next len bytes of the source */
+static bool load_source(lz4_reader_t *r, lz4_reader_slot_t *s, size_t len) {
+  if (!r->src) {
+    s->compressed = s->buffer;
+    return read_source(r, s->buffer, len);
+  }
+  if (len > r->src_len - r->src_pos)
+    return false;
+  s->compressed = r->src + r->src_pos;
+  r->src_pos += len;
+  return true;
+}
+
+/* reads the next block (or the end of the frame), returns the new state */
+static int load_block(lz4_reader_t *r, lz4_reader_slot_t *s) {
+  uint8_t word[4];
+  s->out_len = -1;
+  if (!read_source(r, word, 4))
+    return SLOT_ERROR;
+  uint32_t v = word[0] | (word[1] << 8) | (word[2] << 16) |
+               ((uint32_t)word[3] << 24);
+  if (!v) {
+    s->compressed_len = r->h.content_checksum ? 4 : 0;
+    if (!load_source(r, s, s->compressed_len))
+      return SLOT_ERROR;
+    return SLOT_END;
+  }
+  uint32_t len = v & 0x7FFFFFFFU;
+  if (len > r->h.block_size)
+    return SLOT_ERROR;
+  s->stored = (v & 0x80000000U) ? true : false;
+  s->compressed_len = len + lz4_block_header_size(r->l);
+  if (!load_source(r, s, s->compressed_len))
+    return SLOT_ERROR;
+  return SLOT_LOADED;
+}
+
+static int decode_block(lz4_reader_t *r, lz4_reader_slot_t *s, void *dest,
+                        uint32_t dest_len) {
+  int n = lz4_decompress(r->l, s->compressed, s->compressed_len, dest,
+                         dest_len, !s->stored);
+  return n < 0 ? (n == -500 ? -500 : -1) : n;
+}
+
+/* decompresses into the slot, stored blocks are used where they are */
+static int decode_slot(lz4_reader_t *r, lz4_reader_slot_t *s) {
+  const void *data;
+  int n = lz4_decompress_view(r->l, s->compressed, s->compressed_len,
+                              s->buffer + r->h.compressed_size,
+                              r->h.block_size, !s->stored, &data);
+  s->out = (char *)data;
+  return n < 0 ? (n == -500 ? -500 : -1) : n;
+}
+
+static void *reader_thread(void *arg) {
+  lz4_reader_t *r = (lz4_reader_t *)arg;
+  pthread_mutex_lock(&r->mutex);
+  while (!r->stop) {
+    lz4_reader_slot_t *s = r->slots + (r->tail % LZ4_READER_SLOTS);
+    if (!r->loaded_end && s->state == SLOT_EMPTY) {
+      pthread_mutex_unlock(&r->mutex);
+      int state = load_block(r, s);
+      pthread_mutex_lock(&r->mutex);
+      s->state = state;
+      if (state != SLOT_LOADED)
+        r->loaded_end = true;
+      r->tail++;
+      pthread_cond_broadcast(&r->cond);
+      continue;
+    }
+    /* blocks are decompressed in order, so only the first slot which isn't
+       decoded yet can be */
+    s = NULL;
+    for (uint32_t i = r->head; i != r->tail; i++) {
+      lz4_reader_slot_t *t = r->slots + (i % LZ4_READER_SLOTS);
+      if (t->state != SLOT_DECODED) {
+        s = t;
+        break;
+      }
+    }
+    if (r->read_ahead && s && s->state == SLOT_LOADED) {
+      s->state = SLOT_BUSY;
+      pthread_mutex_unlock(&r->mutex);
+      s->out_len = decode_slot(r, s);
+      pthread_mutex_lock(&r->mutex);
+      s->state = s->out_len < 0 ? SLOT_ERROR : SLOT_DECODED;
+      pthread_cond_broadcast(&r->cond);
+      continue;
+    }
+    pthread_cond_wait(&r->cond, &r->mutex);
+  }
+  pthread_mutex_unlock(&r->mutex);
+  return NULL;
+}
+
+#ifdef _AML_DEBUG_
+lz4_reader_t *_lz4_reader_init(int fd, const void *src, size_t src_len,
+                               const char *caller) {
+#else
+lz4_reader_t *_lz4_reader_init(int fd, const void *src, size_t src_len) {
+#endif
+  lz4_reader_t tmp;
+  tmp.fd = fd;
+  tmp.src = (const char *)src;
+  tmp.src_len = src_len;
+  tmp.src_pos = 0;
+  if (!read_source(&tmp, tmp.header_buf, 7))
+    return NULL;
+  uint32_t header_size = lz4_header_size(tmp.header_buf, 7);
+  if (!header_size ||
+      !read_source(&tmp, tmp.header_buf + 7, header_size - 7))
+    return NULL;
+  lz4_t *l = lz4_init_decompress(tmp.header_buf, header_size);
+  if (!l)
+    return NULL;
+
+  /* each slot holds the compressed block (for fds) followed by the block */
+  uint32_t block_size = lz4_block_size(l);
+  uint32_t compressed_size = lz4_compressed_size(l);
+  size_t slot_size = compressed_size + block_size;
+#ifdef _AML_DEBUG_
+  lz4_reader_t *r = (lz4_reader_t *)_aml_malloc_d(
+      caller, sizeof(lz4_reader_t) + slot_size * LZ4_READER_SLOTS, false);
+#else
+  lz4_reader_t *r = (lz4_reader_t *)aml_malloc(
+      sizeof(lz4_reader_t) + slot_size * LZ4_READER_SLOTS);
+#endif
+  *r = tmp;
+  r->l = l;
+  lz4_check_header(&r->h, r->header_buf, header_size);
+  for (int i = 0; i < LZ4_READER_SLOTS; i++) {
+    lz4_reader_slot_t *s = r->slots + i;
+    s->state = SLOT_EMPTY;
+    s->buffer = (char *)(r + 1) + slot_size * i;
+    s->out = NULL;
+    s->out_len = 0;
+  }
+  r->head = r->tail = 0;
+  r->pos = 0;
+  r->loaded_end = false;
+  r->read_ahead = true;
+  r->stop = false;
+  r->error = 0;
+  pthread_mutex_init(&r->mutex, NULL);
+  pthread_cond_init(&r->cond, NULL);
+  if (pthread_create(&r->thread, NULL, reader_thread, r)) {
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->mutex);
+    lz4_destroy(l);
+    aml_free(r);
+    return NULL;
+  }
+  return r;
+}
+
+const lz4_header_t *lz4_reader_header(lz4_reader_t *r) { return &r->h; }
+
+int64_t lz4_reader_read(lz4_reader_t *r, void *dest, size_t len) {
+  char *destp = (char *)dest;
+  size_t total = 0;
+  pthread_mutex_lock(&r->mutex);
+  while (len && !r->error) {
+    lz4_reader_slot_t *s = r->slots + (r->head % LZ4_READER_SLOTS);
+    while (r->head == r->tail || s->state == SLOT_BUSY)
+      pthread_cond_wait(&r->cond, &r->mutex);
+
+    if (s->state == SLOT_END) {
+      /* stays in this state, the checksum is only verified once */
+      if (s->compressed_len != (uint32_t)-1 &&
+          lz4_finish(r->l, (void *)s->compressed) < 0)
+        r->error = -500;
+      s->compressed_len = (uint32_t)-1;
+      break;
+    }
+    if (s->state == SLOT_ERROR) {
+      r->error = s->out_len == -500 ? -500 : -1;
+      break;
+    }
+    if (s->state == SLOT_LOADED) {
+      s->state = SLOT_BUSY;
+      pthread_mutex_unlock(&r->mutex);
+      int n;
+      bool direct = len >= r->h.block_size;
+      if (direct) {
+        n = decode_block(r, s, destp, r->h.block_size);
+      } else
+        n = decode_slot(r, s);
+      pthread_mutex_lock(&r->mutex);
+      r->read_ahead = !direct;
+      s->out_len = n;
+      if (n < 0) {
+        s->state = SLOT_ERROR;
+        continue;
+      }
+      if (direct) {
+        destp += n;
+        len -= n;
+        total += n;
+        s->state = SLOT_EMPTY;
+        r->head++;
+        pthread_cond_broadcast(&r->cond);
+        continue;
+      }
+      s->state = SLOT_DECODED;
+    }
+    /* SLOT_DECODED */
+    size_t n = s->out_len - r->pos;
+    if (n > len)
+      n = len;
+    memcpy(destp, s->out + r->pos, n);
+    destp += n;
+    len -= n;
+    total += n;
+    r->pos += n;
+    if (r->pos == s->out_len) {
+      r->pos = 0;
+      s->state = SLOT_EMPTY;
+      r->head++;
+      pthread_cond_broadcast(&r->cond);
+    }
+  }
+  int error = r->error;
+  pthread_mutex_unlock(&r->mutex);
+  if (total)
+    return total;
+  return error;
+}
+
+void lz4_reader_destroy(lz4_reader_t *r) {
+  pthread_mutex_lock(&r->mutex);
+  r->stop = true;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->mutex);
+  pthread_join(r->thread, NULL);
+  pthread_cond_destroy(&r->cond);
+  pthread_mutex_destroy(&r->mutex);
+  lz4_destroy(r->l);
+  aml_free(r);
+}
@@ -0,0 +1,243 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "the-lz4-library/lz4_seekable.h"
+
+#include "a-memory-library/aml_alloc.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct lz4_seekable_s {
+  /* the frame is either in memory (data) or read from fd */
+  const char *data;
+  int fd;
+  uint64_t src_len;
+
+  lz4_t *d;
+  uint32_t block_size;
+  uint32_t block_header_size;
+
+  uint32_t num_blocks;
+  /* num_blocks+1 offsets, the last one is the end of the data */
+  uint64_t *compressed_offsets;
+  uint64_t *offsets;
+
+  /* the most recently decompressed block */
+  char *block;
+  int64_t cached_block;
+  uint32_t cached_len;
+
+  /* compressed input when reading from fd */
+  char *io;
+};
+
+static uint32_t read_u32(const char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static bool read_fully(int fd, void *dest, size_t len, uint64_t offset) {
+  char *destp = (char *)dest;
+  while (len) {
+    ssize_t n = pread(fd, destp, len, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    destp += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+/* returns a pointer to len bytes of the source at offset */
+static const char *read_at(lz4_seekable_t *r, uint64_t offset, size_t len,
+                           char *buf) {
+  if (offset > r->src_len || len > r->src_len - offset)
+    return NULL;
+  if (r->data)
+    return r->data + offset;
+  return read_fully(r->fd, buf, len, offset) ? buf : NULL;
+}
+
+static lz4_seekable_t *seekable_init(const void *data, int fd,
+                                     uint64_t src_len) {
+  char header[LZ4_MAX_HEADER_SIZE];
+  char footer[8];
+  if (src_len < 7 + 4 + 16)
+    return NULL;
+
+  lz4_seekable_t tmp;
+  tmp.data = (const char *)data;
+  tmp.fd = fd;
+  tmp.src_len = src_len;
+  const char *footerp = read_at(&tmp, src_len - 8, 8, footer);
+  if (!footerp || read_u32(footerp + 4) != LZ4_SEEK_TABLE_MAGIC)
+    return NULL;
+  uint64_t num_blocks = read_u32(footerp);
+  uint64_t table_size = num_blocks * 8 + 16;
+  if (table_size > src_len - 7 - 4)
+    return NULL;
+  uint64_t table_offset = src_len - table_size;
+
+  uint32_t header_size = table_offset < LZ4_MAX_HEADER_SIZE
+                             ? table_offset
+                             : LZ4_MAX_HEADER_SIZE;
+  const char *headerp = read_at(&tmp, 0, header_size, header);
+  lz4_header_t h;
+  if (!headerp || !lz4_check_header(&h, (void *)headerp, header_size) ||
+      h.linked_blocks || h.has_dict_id)
+    return NULL;
+  header_size = h.header_size;
+
+  lz4_seekable_t *r = (lz4_seekable_t *)aml_malloc(
+      sizeof(lz4_seekable_t) + sizeof(uint64_t) * (num_blocks + 1) * 2);
+  *r = tmp;
+  r->d = lz4_init_decompress((void *)headerp, header_size);
+  r->block_size = h.block_size;
+  r->block_header_size = lz4_block_header_size(r->d);
+  r->num_blocks = num_blocks;
+  r->compressed_offsets = (uint64_t *)(r + 1);
+  r->offsets = r->compressed_offsets + num_blocks + 1;
+  r->block = NULL;
+  r->cached_block = -1;
+  r->cached_len = 0;
+  r->io = NULL;
+
+  char *table = NULL;
+  if (!data)
+    table = (char *)aml_malloc(table_size);
+  const char *tablep = read_at(r, table_offset, table_size, table);
+  bool ok = tablep && read_u32(tablep) == LZ4_SEEK_TABLE_FRAME_MAGIC &&
+            read_u32(tablep + 4) == table_size - 8;
+  uint64_t compressed_offset = header_size;
+  uint64_t offset = 0;
+  for (uint32_t i = 0; ok && i < num_blocks; i++) {
+    uint32_t compressed_size = read_u32(tablep + 8 + i * 8);
+    uint32_t size = read_u32(tablep + 12 + i * 8);
+    if (size > h.block_size || compressed_size < 4 ||
+        compressed_size > h.compressed_size + 4 + r->block_header_size)
+      ok = false;
+    r->compressed_offsets[i] = compressed_offset;
+    r->offsets[i] = offset;
+    compressed_offset += compressed_size;
+    offset += size;
+  }
+  r->compressed_offsets[num_blocks] = compressed_offset;
+  r->offsets[num_blocks] = offset;
+  /* the blocks, end mark and content checksum must end at the table */
+  if (ok && compressed_offset + 4 + (h.content_checksum ? 4 : 0) !=
+                table_offset)
+    ok = false;
+  if (table)
+    aml_free(table);
+  if (!ok) {
+    lz4_seekable_destroy(r);
+    return NULL;
+  }
+  r->block = (char *)aml_malloc(r->block_size);
+  if (!data)
+    r->io = (char *)aml_malloc(h.compressed_size + 4 + r->block_header_size);
+  return r;
+}
+
+lz4_seekable_t *lz4_seekable_init(const void *src, size_t src_len) {
+  return seekable_init(src, -1, src_len);
+}
+
+lz4_seekable_t *lz4_seekable_open(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return NULL;
+  return seekable_init(NULL, fd, st.st_size);
+}
+
+uint64_t lz4_seekable_size(lz4_seekable_t *r) {
+  return r->offsets[r->num_blocks];
+}
+
+uint32_t lz4_seekable_num_blocks(lz4_seekable_t *r) { return r->num_blocks; }
+
+/* index of the block which contains offset, offset must be less than the
+   size */
+static uint32_t find_block(lz4_seekable_t *r, uint64_t offset) {
+  uint32_t lo = 0, hi = r->num_blocks;
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (r->offsets[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static int decompress_block(lz4_seekable_t *r, uint32_t block, char *dest,
+                            uint32_t dest_len) {
+  uint64_t offset = r->compressed_offsets[block];
+  uint32_t len = r->compressed_offsets[block + 1] - offset;
+  const char *src = read_at(r, offset, len, r->io);
+  if (!src)
+    return -1;
+  uint32_t v = read_u32(src);
+  if ((v & 0x7FFFFFFFU) + 4 + r->block_header_size != len)
+    return -1;
+  int n = lz4_decompress_independent(r->d, src + 4, len - 4, dest, dest_len,
+                                     !(v & 0x80000000U));
+  if (n >= 0 && (uint64_t)n != r->offsets[block + 1] - r->offsets[block])
+    return -1;
+  return n;
+}
+
+int64_t lz4_seekable_read(lz4_seekable_t *r, void *dest, size_t len,
+                          uint64_t offset) {
+  uint64_t size = lz4_seekable_size(r);
+  if (offset >= size || !len)
+    return 0;
+  if (len > size - offset)
+    len = size - offset;
+
+  char *destp = (char *)dest;
+  size_t remaining = len;
+  uint32_t block = find_block(r, offset);
+  while (remaining) {
+    uint64_t block_offset = r->offsets[block];
+    uint32_t block_len = r->offsets[block + 1] - block_offset;
+    uint32_t skip = offset - block_offset;
+    uint32_t n = block_len - skip;
+    if (n > remaining)
+      n = remaining;
+    if (n == block_len && block != r->cached_block) {
+      /* whole blocks are decompressed straight into dest */
+      if (decompress_block(r, block, destp, block_len) < 0)
+        return -1;
+    } else {
+      if (block != r->cached_block) {
+        r->cached_block = -1;
+        if (decompress_block(r, block, r->block, r->block_size) < 0)
+          return -1;
+        r->cached_block = block;
+      }
+      memcpy(destp, r->block + skip, n);
+    }
+    destp += n;
+    offset += n;
+    remaining -= n;
+    block++;
+  }
+  return len;
+}
+
+void lz4_seekable_destroy(lz4_seekable_t *r) {
+  if (r->block)
+    aml_free(r->block);
+  if (r->io)
+    aml_free(r->io);
+  lz4_destroy(r->d);
+  aml_free(r);
+}
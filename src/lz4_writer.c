@@ -0,0 +1,197 @@
+// SPDX-FileCopyrightText:  2019-2025 Andy Curtis <contactandyc@gmail.com>
+// SPDX-FileCopyrightText: 2024-2025 Knode.ai
+// SPDX-License-Identifier: Apache-2.0
+#include "the-lz4-library/lz4_writer.h"
+#include "the-lz4-library/lz4_seekable.h"
+
+#include "a-memory-library/aml_alloc.h"
+#include "a-memory-library/aml_buffer.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+struct lz4_writer_s {
+  lz4_t *l;
+  int fd;
+  FILE *file;
+
+  uint32_t block_size;
+  uint32_t compressed_size;
+
+  /* the caller fills in[current] while the thread compresses the other */
+  char *in[2];
+  uint32_t in_len;
+  int current;
+  char *out;
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  /* block handed to the thread, guarded by mutex */
+  bool pending;
+  int pending_index;
+  uint32_t pending_len;
+  bool closing;
+  /* set by the thread, read by the caller after waiting on pending */
+  bool error;
+};
+
+static bool write_output(lz4_writer_t *w, const void *data, size_t len) {
+  if (w->file)
+    return fwrite(data, 1, len, w->file) == len;
+  const char *p = (const char *)data;
+  while (len) {
+    ssize_t n = write(w->fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static void *writer_thread(void *arg) {
+  lz4_writer_t *w = (lz4_writer_t *)arg;
+  uint32_t header_size;
+  const void *header = lz4_get_header(w->l, &header_size);
+  bool error = !write_output(w, header, header_size);
+
+  pthread_mutex_lock(&w->mutex);
+  while (true) {
+    while (!w->pending && !w->closing)
+      pthread_cond_wait(&w->cond, &w->mutex);
+    if (!w->pending)
+      break;
+    const char *src = w->in[w->pending_index];
+    uint32_t src_len = w->pending_len;
+    pthread_mutex_unlock(&w->mutex);
+
+    uint32_t n =
+        lz4_compress_block(w->l, src, src_len, w->out, w->compressed_size);
+    if (!error)
+      error = !write_output(w, w->out, n);
+
+    pthread_mutex_lock(&w->mutex);
+    w->error = error;
+    w->pending = false;
+    pthread_cond_broadcast(&w->cond);
+  }
+  w->error = error;
+  pthread_mutex_unlock(&w->mutex);
+  return NULL;
+}
+
+/* waits until the thread is done with the previous block */
+static bool wait_for_block(lz4_writer_t *w) {
+  pthread_mutex_lock(&w->mutex);
+  while (w->pending)
+    pthread_cond_wait(&w->cond, &w->mutex);
+  bool error = w->error;
+  pthread_mutex_unlock(&w->mutex);
+  return !error;
+}
+
+static void submit_block(lz4_writer_t *w) {
+  wait_for_block(w);
+  pthread_mutex_lock(&w->mutex);
+  w->pending = true;
+  w->pending_index = w->current;
+  w->pending_len = w->in_len;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->mutex);
+  w->current = 1 - w->current;
+  w->in_len = 0;
+}
+
+#ifdef _AML_DEBUG_
+lz4_writer_t *_lz4_writer_init(int fd, FILE *file, lz4_t *l,
+                               const char *caller) {
+#else
+lz4_writer_t *_lz4_writer_init(int fd, FILE *file, lz4_t *l) {
+#endif
+  uint32_t block_size = lz4_block_size(l);
+  uint32_t compressed_size = lz4_compressed_size(l);
+#ifdef _AML_DEBUG_
+  lz4_writer_t *w = (lz4_writer_t *)_aml_malloc_d(
+      caller, sizeof(lz4_writer_t) + block_size * 2 + compressed_size, false);
+#else
+  lz4_writer_t *w = (lz4_writer_t *)aml_malloc(
+      sizeof(lz4_writer_t) + block_size * 2 + compressed_size);
+#endif
+  w->l = l;
+  w->fd = fd;
+  w->file = file;
+  w->block_size = block_size;
+  w->compressed_size = compressed_size;
+  w->in[0] = (char *)(w + 1);
+  w->in[1] = w->in[0] + block_size;
+  w->out = w->in[1] + block_size;
+  w->in_len = 0;
+  w->current = 0;
+  w->pending = false;
+  w->closing = false;
+  w->error = false;
+  pthread_mutex_init(&w->mutex, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  if (pthread_create(&w->thread, NULL, writer_thread, w)) {
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->mutex);
+    aml_free(w);
+    return NULL;
+  }
+  return w;
+}
+
+bool lz4_writer_write(lz4_writer_t *w, const void *src, size_t src_len) {
+  const char *srcp = (const char *)src;
+  while (src_len) {
+    uint32_t n = w->block_size - w->in_len;
+    if (n > src_len)
+      n = src_len;
+    memcpy(w->in[w->current] + w->in_len, srcp, n);
+    w->in_len += n;
+    srcp += n;
+    src_len -= n;
+    if (w->in_len == w->block_size)
+      submit_block(w);
+  }
+  pthread_mutex_lock(&w->mutex);
+  bool error = w->error;
+  pthread_mutex_unlock(&w->mutex);
+  return !error;
+}
+
+bool lz4_writer_close(lz4_writer_t *w) {
+  if (w->in_len)
+    submit_block(w);
+  wait_for_block(w);
+  pthread_mutex_lock(&w->mutex);
+  w->closing = true;
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->mutex);
+  pthread_join(w->thread, NULL);
+
+  bool ok = !w->error;
+  /* the end mark and checksum are at most 8 bytes */
+  char tail[8];
+  int n = lz4_finish(w->l, tail);
+  ok = ok && n >= 0 && write_output(w, tail, n);
+
+  aml_buffer_t *seek_table = aml_buffer_init(256);
+  if (lz4_write_seek_table(w->l, seek_table))
+    ok = ok && write_output(w, aml_buffer_data(seek_table),
+                            aml_buffer_length(seek_table));
+  aml_buffer_destroy(seek_table);
+
+  if (w->file)
+    ok = fflush(w->file) == 0 && ok;
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->mutex);
+  aml_free(w);
+  return ok;
+}
@@ -2,10 +2,23 @@
 // SPDX-FileCopyrightText: 2024-2025 Knode.ai
 // SPDX-License-Identifier: Apache-2.0
 #include "the-lz4-library/lz4.h"
+#include "the-lz4-library/lz4_async.h"
+#include "the-lz4-library/lz4_dict.h"
+#include "the-lz4-library/lz4_file.h"
+#include "the-lz4-library/lz4_hash.h"
+#include "the-lz4-library/lz4_parallel.h"
+#include "the-lz4-library/lz4_reader.h"
+#include "the-lz4-library/lz4_seekable.h"
+#include "the-lz4-library/lz4_writer.h"
 #include "a-memory-library/aml_buffer.h"
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+static int failures = 0;
 
 #define TEST_STRING "This is a test string to verify LZ4 compression and decompression functionality."
 
@@ -134,8 +147,1396 @@ void test_lz4_block_compression() {
     lz4_destroy(lz4_ctx);
 }
 
+static size_t fill_log_lines(char *dest, size_t len) {
+    size_t pos = 0;
+    unsigned int seq = 0;
+    while (pos < len) {
+        char line[128];
+        int n = snprintf(line, sizeof(line),
+                         "2024-01-01T00:00:%02u INFO request id=%u path=/api/v1/items/%u status=200\n",
+                         seq % 60, seq * 7919u, seq % 113);
+        if ((size_t)n > len - pos)
+            n = (int)(len - pos);
+        memcpy(dest + pos, line, n);
+        pos += n;
+        seq++;
+    }
+    return pos;
+}
+
+/* appends the frame for src compressed one block at a time with c */
+static void compress_frame(lz4_t *c, aml_buffer_t *dest, const char *src, size_t len) {
+    uint32_t header_size;
+    const char *header = lz4_get_header(c, &header_size);
+    aml_buffer_append(dest, header, header_size);
+    uint32_t block_size = lz4_block_size(c);
+    char *block = (char *)malloc(lz4_compressed_size(c));
+    for (size_t pos = 0; pos < len; pos += block_size) {
+        uint32_t n = (len - pos) < block_size ? (uint32_t)(len - pos) : block_size;
+        aml_buffer_append(dest, block, lz4_compress_block(c, src + pos, n, block, lz4_compressed_size(c)));
+    }
+    aml_buffer_append(dest, block, lz4_finish(c, block));
+    free(block);
+}
+
+/* decompresses frame one block at a time (using dict if not NULL) and
+   compares it with src */
+static bool decompress_frame_matches_with_dict(const char *frame, size_t frame_len, const char *src, size_t len,
+                                               lz4_dict_t *dict) {
+    lz4_header_t h;
+    if (!lz4_check_header(&h, (void *)frame, frame_len < LZ4_MAX_HEADER_SIZE ? frame_len : LZ4_MAX_HEADER_SIZE))
+        return false;
+    lz4_t *d = lz4_init_decompress((void *)frame, h.header_size);
+    if (!d)
+        return false;
+    if (dict && !lz4_set_dictionary(d, dict)) {
+        lz4_destroy(d);
+        return false;
+    }
+    uint32_t block_size = lz4_block_size(d);
+    char *out = (char *)malloc(block_size);
+    size_t pos = h.header_size, out_len = 0;
+    bool ok = true;
+    while (ok) {
+        uint32_t v;
+        if (pos + 4 > frame_len) {
+            ok = false;
+            break;
+        }
+        memcpy(&v, frame + pos, 4);
+        pos += 4;
+        if (!v)
+            break;
+        bool compressed = !(v & 0x80000000U);
+        uint32_t n = (v & 0x7FFFFFFFU) + lz4_block_header_size(d);
+        int r = lz4_decompress(d, frame + pos, n, out, block_size, compressed);
+        if (r < 0 || out_len + r > len || memcmp(out, src + out_len, r))
+            ok = false;
+        out_len += r > 0 ? r : 0;
+        pos += n;
+    }
+    if (ok && (out_len != len || lz4_finish(d, (void *)(frame + pos)) < 0))
+        ok = false;
+    lz4_destroy(d);
+    free(out);
+    return ok;
+}
+
+static bool decompress_frame_matches(const char *frame, size_t frame_len, const char *src, size_t len) {
+    return decompress_frame_matches_with_dict(frame, frame_len, src, len, NULL);
+}
+
+/* compresses src as a frame and decompresses it again, returns the frame size
+   or 0 on a mismatch */
+static size_t round_trip_frame(lz4_t *c, const char *src, size_t len) {
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    compress_frame(c, frame, src, len);
+    size_t frame_len = aml_buffer_length(frame);
+    bool ok = decompress_frame_matches(aml_buffer_data(frame), frame_len, src, len);
+    aml_buffer_destroy(frame);
+    return ok ? frame_len : 0;
+}
+
+void test_lz4_linked_blocks() {
+    printf("\nRunning LZ4 linked block test...\n");
+
+    size_t len = 1024 * 1024;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+
+    int levels[] = {1, 9};
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        lz4_t *independent = lz4_init(levels[i], s64kb, true, true);
+        lz4_t *linked = lz4_init_linked(levels[i], s64kb, true, true);
+        size_t independent_size = round_trip_frame(independent, src, len);
+        size_t linked_size = round_trip_frame(linked, src, len);
+        if (independent_size && linked_size && linked_size <= independent_size)
+            printf("Linked block test passed (level %d): %zu vs %zu bytes\n",
+                   levels[i], linked_size, independent_size);
+        else {
+            printf("Linked block test failed (level %d): %zu vs %zu bytes\n",
+                   levels[i], linked_size, independent_size);
+            failures++;
+        }
+        lz4_destroy(independent);
+        lz4_destroy(linked);
+    }
+
+    /* skipping blocks keeps the history, so the blocks after them decode */
+    lz4_t *c = lz4_init_linked(1, s64kb, true, false);
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    compress_frame(c, frame, src, len);
+    lz4_destroy(c);
+    char *p = aml_buffer_data(frame);
+    uint32_t header_size = lz4_header_size(p, aml_buffer_length(frame));
+    lz4_t *d = lz4_init_decompress(p, header_size);
+    char *out = (char *)malloc(64 * 1024);
+    bool ok = d != NULL;
+    size_t pos = 0;
+    for (p += header_size; ok; pos += 64 * 1024) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        p += 4;
+        if (!v)
+            break;
+        uint32_t n = (v & 0x7FFFFFFFU) + lz4_block_header_size(d);
+        bool compressed = !(v & 0x80000000U);
+        if (pos / (64 * 1024) % 4 == 1)
+            ok = lz4_skip(d, p, n, out, 64 * 1024, compressed);
+        else {
+            int r = lz4_decompress(d, p, n, out, 64 * 1024, compressed);
+            ok = r > 0 && !memcmp(out, src + pos, r);
+        }
+        p += n;
+    }
+    ok = ok && pos == len;
+    if (ok)
+        printf("Linked block test passed (skipping blocks)\n");
+    else {
+        printf("Linked block test failed (skipping blocks)\n");
+        failures++;
+    }
+    if (d)
+        lz4_destroy(d);
+    free(out);
+    aml_buffer_destroy(frame);
+    free(src);
+}
+
+void test_lz4_parallel_compression() {
+    printf("\nRunning LZ4 parallel compression test...\n");
+
+    /* two full blocks, a partial block and a mix of compressible and random
+       data so that some blocks are stored */
+    size_t len = 2 * 256 * 1024 + 12345;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+    srand(7);
+    for (size_t i = 256 * 1024; i < 384 * 1024; i++)
+        src[i] = (char)rand();
+
+    int levels[] = {-2, 1, 9};
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        lz4_t *c = lz4_init(levels[i], s256kb, true, true);
+        aml_buffer_t *expected = aml_buffer_init(1024);
+        compress_frame(c, expected, src, len);
+        lz4_destroy(c);
+
+        lz4_parallel_t *p = lz4_parallel_init(levels[i], s256kb, true, true, 3);
+        aml_buffer_t *frame = aml_buffer_init(1024);
+        /* uneven writes exercise the partial block */
+        lz4_parallel_write(p, frame, src, 1000);
+        lz4_parallel_write(p, frame, src + 1000, len - 1000);
+        lz4_parallel_finish(p, frame);
+        bool ok = aml_buffer_length(frame) == aml_buffer_length(expected) &&
+                  !memcmp(aml_buffer_data(frame), aml_buffer_data(expected), aml_buffer_length(frame));
+
+        /* the context is reusable for another frame */
+        aml_buffer_clear(frame);
+        lz4_parallel_compress(p, frame, src, len);
+        ok = ok && aml_buffer_length(frame) == aml_buffer_length(expected) &&
+             !memcmp(aml_buffer_data(frame), aml_buffer_data(expected), aml_buffer_length(frame));
+        ok = ok && decompress_frame_matches(aml_buffer_data(frame), aml_buffer_length(frame), src, len);
+
+        /* one block per write, the blocks are compressed while more are
+           written */
+        aml_buffer_clear(frame);
+        for (size_t pos = 0; pos < len; pos += 256 * 1024)
+            lz4_parallel_write(p, frame, src + pos, len - pos < 256 * 1024 ? len - pos : 256 * 1024);
+        lz4_parallel_finish(p, frame);
+        ok = ok && aml_buffer_length(frame) == aml_buffer_length(expected) &&
+             !memcmp(aml_buffer_data(frame), aml_buffer_data(expected), aml_buffer_length(frame));
+
+        if (ok)
+            printf("Parallel compression test passed (level %d): %zu bytes\n", levels[i], aml_buffer_length(frame));
+        else {
+            printf("Parallel compression test failed (level %d)\n", levels[i]);
+            failures++;
+        }
+        lz4_parallel_destroy(p);
+        aml_buffer_destroy(frame);
+        aml_buffer_destroy(expected);
+    }
+
+    /* more blocks than fit in the window, written one at a time and all at
+       once */
+    lz4_t *c = lz4_init(1, s64kb, true, true);
+    aml_buffer_t *expected = aml_buffer_init(1024);
+    compress_frame(c, expected, src, len);
+    lz4_destroy(c);
+    lz4_parallel_t *p = lz4_parallel_init(1, s64kb, true, true, 2);
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    for (size_t pos = 0; pos < len; pos += 64 * 1024)
+        lz4_parallel_write(p, frame, src + pos, len - pos < 64 * 1024 ? len - pos : 64 * 1024);
+    lz4_parallel_finish(p, frame);
+    bool ok = aml_buffer_length(frame) == aml_buffer_length(expected) &&
+              !memcmp(aml_buffer_data(frame), aml_buffer_data(expected), aml_buffer_length(frame));
+    aml_buffer_clear(frame);
+    lz4_parallel_compress(p, frame, src, len);
+    ok = ok && aml_buffer_length(frame) == aml_buffer_length(expected) &&
+         !memcmp(aml_buffer_data(frame), aml_buffer_data(expected), aml_buffer_length(frame));
+    if (ok)
+        printf("Parallel compression test passed (64KB blocks, one per write)\n");
+    else {
+        printf("Parallel compression test failed (64KB blocks, one per write)\n");
+        failures++;
+    }
+    lz4_parallel_destroy(p);
+    aml_buffer_destroy(frame);
+    aml_buffer_destroy(expected);
+    free(src);
+}
+
+void test_lz4_parallel_decompression() {
+    printf("\nRunning LZ4 parallel decompression test...\n");
+
+    size_t len = 5 * 64 * 1024 + 777;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+    srand(11);
+    for (size_t i = 64 * 1024; i < 128 * 1024; i++)
+        src[i] = (char)rand();
+
+    lz4_t *c = lz4_init(1, s64kb, true, true);
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    compress_frame(c, frame, src, len);
+    lz4_destroy(c);
+
+    aml_buffer_t *out = aml_buffer_init(16);
+    aml_buffer_append(out, "x", 1);
+    int64_t r = lz4_parallel_decompress(out, aml_buffer_data(frame), aml_buffer_length(frame), 4);
+    bool ok = r == (int64_t)len && aml_buffer_length(out) == len + 1 &&
+              !memcmp(aml_buffer_data(out) + 1, src, len);
+
+    /* a corrupt content checksum is reported and dest is left unchanged */
+    aml_buffer_data(frame)[aml_buffer_length(frame) - 1] ^= 1;
+    r = lz4_parallel_decompress(out, aml_buffer_data(frame), aml_buffer_length(frame), 4);
+    ok = ok && r == -500 && aml_buffer_length(out) == len + 1;
+
+    /* as is a corrupt block */
+    aml_buffer_data(frame)[aml_buffer_length(frame) - 1] ^= 1;
+    aml_buffer_data(frame)[20] ^= 1;
+    r = lz4_parallel_decompress(out, aml_buffer_data(frame), aml_buffer_length(frame), 4);
+    ok = ok && r < 0 && aml_buffer_length(out) == len + 1;
+
+    /* 1000 one-byte blocks of a 4MB block frame would need 4GB of output, the
+       frame is rejected without allocating it */
+    lz4_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.size = s4mb;
+    aml_buffer_clear(frame);
+    char header[LZ4_MAX_HEADER_SIZE];
+    aml_buffer_append(frame, header, lz4_write_header(header, &h));
+    for (int i = 0; i < 1000; i++)
+        aml_buffer_append(frame, "\x01\x00\x00\x00\x00", 5);
+    aml_buffer_append(frame, "\x00\x00\x00\x00", 4);
+    r = lz4_parallel_decompress(out, aml_buffer_data(frame), aml_buffer_length(frame), 4);
+    ok = ok && r == -1 && aml_buffer_length(out) == len + 1;
+
+    if (ok)
+        printf("Parallel decompression test passed.\n");
+    else {
+        printf("Parallel decompression test failed.\n");
+        failures++;
+    }
+    aml_buffer_destroy(out);
+    aml_buffer_destroy(frame);
+    free(src);
+}
+
+void test_lz4_seekable() {
+    printf("\nRunning LZ4 seekable frame test...\n");
+
+    size_t len = 10 * 64 * 1024 + 4321;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+
+    lz4_t *c = lz4_init(1, s64kb, true, true);
+    lz4_enable_seek_table(c);
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    compress_frame(c, frame, src, len);
+    size_t frame_len = aml_buffer_length(frame);
+    lz4_write_seek_table(c, frame);
+    lz4_destroy(c);
+
+    /* the frame itself is unaffected by the table */
+    bool ok = decompress_frame_matches(aml_buffer_data(frame), frame_len, src, len);
+
+    lz4_seekable_t *r = lz4_seekable_init(aml_buffer_data(frame), aml_buffer_length(frame));
+    ok = ok && r && lz4_seekable_size(r) == len && lz4_seekable_num_blocks(r) == 11;
+    char *out = (char *)malloc(len);
+    size_t reads[][2] = {{0, 10}, {65530, 20}, {100000, 3 * 65536}, {0, len}, {len - 5, 100}, {131072, 65536}};
+    for (size_t i = 0; ok && i < sizeof(reads) / sizeof(reads[0]); i++) {
+        size_t expected = reads[i][1];
+        if (reads[i][0] + expected > len)
+            expected = len - reads[i][0];
+        int64_t n = lz4_seekable_read(r, out, reads[i][1], reads[i][0]);
+        ok = n == (int64_t)expected && !memcmp(out, src + reads[i][0], expected);
+    }
+    ok = ok && lz4_seekable_read(r, out, 10, len) == 0;
+    if (r)
+        lz4_seekable_destroy(r);
+
+    /* a frame without a table is rejected */
+    ok = ok && !lz4_seekable_init(aml_buffer_data(frame), frame_len);
+
+    if (ok)
+        printf("Seekable frame test passed.\n");
+    else {
+        printf("Seekable frame test failed.\n");
+        failures++;
+    }
+    free(out);
+    aml_buffer_destroy(frame);
+    free(src);
+}
+
+void test_lz4_frame_header() {
+    printf("\nRunning LZ4 frame header test...\n");
+
+    /* the headers written by lz4_init must match the ones produced by the lz4
+       tools for the same options */
+    const uint8_t expected[][7] = {
+        {0x04, 0x22, 0x4d, 0x18, 0x60, 0x40, 0x82}, {0x04, 0x22, 0x4d, 0x18, 0x74, 0x40, 0xbd},
+        {0x04, 0x22, 0x4d, 0x18, 0x64, 0x50, 0x08}, {0x04, 0x22, 0x4d, 0x18, 0x70, 0x60, 0x33},
+        {0x04, 0x22, 0x4d, 0x18, 0x74, 0x70, 0x8e}};
+    const int options[][3] = {{s64kb, 0, 0}, {s64kb, 1, 1}, {s256kb, 0, 1}, {s1mb, 1, 0}, {s4mb, 1, 1}};
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        lz4_t *c = lz4_init(1, (lz4_block_size_t)options[i][0], options[i][1], options[i][2]);
+        uint32_t header_size;
+        const char *header = lz4_get_header(c, &header_size);
+        ok = ok && header_size == 7 && !memcmp(header, expected[i], 7);
+        lz4_destroy(c);
+    }
+
+    /* content size and dictionary id round trip */
+    lz4_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.size = s1mb;
+    h.content_checksum = true;
+    h.has_content_size = true;
+    h.content_size = 123456789012ULL;
+    h.has_dict_id = true;
+    h.dict_id = 0xabcdef;
+    char header[LZ4_MAX_HEADER_SIZE];
+    uint32_t header_size = lz4_write_header(header, &h);
+    lz4_header_t r;
+    ok = ok && header_size == 19 && lz4_header_size(header, 5) == 19 &&
+         lz4_check_header(&r, header, header_size) && r.header_size == 19 &&
+         r.has_content_size && r.content_size == h.content_size && r.has_dict_id &&
+         r.dict_id == h.dict_id && r.size == s1mb && r.block_size == 1024 * 1024 &&
+         r.content_checksum && !r.block_checksum && !r.linked_blocks;
+
+    /* a corrupt header checksum is rejected */
+    header[18] ^= 1;
+    ok = ok && !lz4_check_header(&r, header, header_size);
+
+    /* frames with a content size decompress */
+    size_t len = 200000;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+    lz4_t *c = lz4_init(1, s64kb, false, true);
+    lz4_set_content_size(c, len);
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    compress_frame(c, frame, src, len);
+    lz4_destroy(c);
+    ok = ok && lz4_check_header(&r, aml_buffer_data(frame), LZ4_MAX_HEADER_SIZE) &&
+         r.header_size == 15 && r.content_size == len;
+    ok = ok && decompress_frame_matches(aml_buffer_data(frame), aml_buffer_length(frame), src, len);
+    aml_buffer_t *out = aml_buffer_init(16);
+    ok = ok && lz4_parallel_decompress(out, aml_buffer_data(frame), aml_buffer_length(frame), 2) == (int64_t)len &&
+         !memcmp(aml_buffer_data(out), src, len);
+
+    if (ok)
+        printf("Frame header test passed.\n");
+    else {
+        printf("Frame header test failed.\n");
+        failures++;
+    }
+    aml_buffer_destroy(out);
+    aml_buffer_destroy(frame);
+    free(src);
+}
+
+void test_lz4_records() {
+    printf("\nRunning LZ4 record test...\n");
+
+    char src[4096];
+    fill_log_lines(src, sizeof(src));
+    char random[300];
+    srand(3);
+    for (size_t i = 0; i < sizeof(random); i++)
+        random[i] = (char)rand();
+
+    struct {
+        const char *data;
+        int len;
+        int level;
+        bool checksum;
+    } cases[] = {{src, sizeof(src), 1, true}, {src, 100, 9, false}, {random, sizeof(random), 1, true},
+                 {src, 0, 0, true}, {src, 3000, -3, false}};
+
+    bool ok = true;
+    aml_buffer_t *record = aml_buffer_init(16);
+    aml_buffer_t *out = aml_buffer_init(16);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        aml_buffer_clear(record);
+        aml_buffer_clear(out);
+        size_t n = lz4_compress_record_appending_to_buffer(record, cases[i].data, cases[i].len, cases[i].level,
+                                                           cases[i].checksum);
+        ok = ok && n == aml_buffer_length(record) &&
+             lz4_record_size(aml_buffer_data(record), n) == cases[i].len &&
+             lz4_decompress_record_appending_to_buffer(out, aml_buffer_data(record), n) &&
+             aml_buffer_length(out) == (size_t)cases[i].len &&
+             !memcmp(aml_buffer_data(out), cases[i].data, cases[i].len);
+    }
+
+    /* a corrupt record fails its checksum and leaves dest alone */
+    aml_buffer_clear(record);
+    aml_buffer_clear(out);
+    size_t n = lz4_compress_record_appending_to_buffer(record, random, sizeof(random), 1, true);
+    aml_buffer_data(record)[n - 1] ^= 1;
+    ok = ok && !lz4_decompress_record_appending_to_buffer(out, aml_buffer_data(record), n) &&
+         aml_buffer_length(out) == 0;
+
+    /* headers claiming about 2GB are rejected before anything is allocated */
+    const char huge[] = {(char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, 0x07, 0x00, 0x10};
+    const char huge_stored[] = {(char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, 0x07, 0x40, 0x10};
+    const char empty[] = {0x05, 0x00};
+    ok = ok && lz4_record_size(huge, sizeof(huge)) == INT32_MAX &&
+         !lz4_decompress_record_appending_to_buffer(out, huge, sizeof(huge)) &&
+         !lz4_decompress_record_appending_to_buffer(out, huge_stored, sizeof(huge_stored)) &&
+         !lz4_decompress_record_appending_to_buffer(out, empty, sizeof(empty)) && aml_buffer_length(out) == 0;
+
+    if (ok)
+        printf("Record test passed.\n");
+    else {
+        printf("Record test failed.\n");
+        failures++;
+    }
+    aml_buffer_destroy(out);
+    aml_buffer_destroy(record);
+}
+
+/* small json-like documents which share most of their structure */
+static int fill_document(char *dest, size_t len, unsigned int seq) {
+    return snprintf(dest, len,
+                    "{\"id\":%u,\"type\":\"order\",\"customer\":{\"name\":\"customer-%u\",\"tier\":\"%s\"},"
+                    "\"items\":[{\"sku\":\"SKU-%05u\",\"quantity\":%u,\"currency\":\"USD\"}],"
+                    "\"status\":\"%s\",\"created_at\":\"2024-03-%02uT10:%02u:00Z\"}",
+                    seq * 2654435761u, seq % 97, seq % 3 ? "standard" : "premium", (seq * 31) % 100000, seq % 9 + 1,
+                    seq % 4 ? "shipped" : "pending", seq % 28 + 1, seq % 60);
+}
+
+void test_lz4_dictionary() {
+    printf("\nRunning LZ4 dictionary test...\n");
+
+    enum { NUM_SAMPLES = 500 };
+    char *samples = (char *)malloc(NUM_SAMPLES * 256);
+    const void *sample_ptrs[NUM_SAMPLES];
+    size_t sample_sizes[NUM_SAMPLES];
+    for (unsigned int i = 0; i < NUM_SAMPLES; i++) {
+        sample_ptrs[i] = samples + i * 256;
+        sample_sizes[i] = fill_document(samples + i * 256, 256, i);
+    }
+
+    aml_buffer_t *trained = aml_buffer_init(1024);
+    size_t dict_size = lz4_dict_train(trained, sample_ptrs, sample_sizes, NUM_SAMPLES, 4096);
+    lz4_dict_t *dict = lz4_dict_init(aml_buffer_data(trained), dict_size, 0);
+    bool ok = dict_size > 0 && dict_size <= 4096 && lz4_dict_id(dict) != 0;
+
+    /* documents which weren't part of the training compress better */
+    size_t plain = 0, with_dict = 0;
+    aml_buffer_t *compressed = aml_buffer_init(256);
+    for (unsigned int i = NUM_SAMPLES; i < NUM_SAMPLES + 100 && ok; i++) {
+        char doc[256], out[256];
+        int n = fill_document(doc, sizeof(doc), i);
+        int levels[] = {1, 9};
+        for (size_t j = 0; j < 2; j++) {
+            aml_buffer_clear(compressed);
+            plain += lz4_compress_appending_to_buffer(compressed, doc, n, levels[j]);
+            aml_buffer_clear(compressed);
+            size_t c = lz4_compress_appending_to_buffer_with_dict(compressed, doc, n, levels[j], dict);
+            with_dict += c;
+            ok = ok && c > 0 &&
+                 lz4_decompress_into_fixed_buffer_with_dict(out, n, aml_buffer_data(compressed), c, dict) &&
+                 !memcmp(out, doc, n);
+        }
+    }
+    ok = ok && with_dict * 2 < plain;
+
+    /* frames carry the dictionary id and can't be decompressed without it */
+    size_t len = 256 * 1024;
+    char *src = (char *)malloc(len);
+    size_t pos = 0;
+    for (unsigned int i = 0; pos + 256 < len; i++)
+        pos += fill_document(src + pos, 256, i);
+    len = pos;
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    lz4_dict_t *other = lz4_dict_init("not the dictionary", 18, 0);
+    for (int linked = 0; linked < 2 && ok; linked++) {
+        int levels[] = {1, 9};
+        for (size_t j = 0; j < 2 && ok; j++) {
+            lz4_t *c = linked ? lz4_init_linked(levels[j], s64kb, true, true) : lz4_init(levels[j], s64kb, true, true);
+            ok = lz4_set_dictionary(c, dict);
+            aml_buffer_clear(frame);
+            compress_frame(c, frame, src, len);
+            lz4_header_t h;
+            ok = ok && lz4_check_header(&h, aml_buffer_data(frame), LZ4_MAX_HEADER_SIZE) && h.has_dict_id &&
+                 h.dict_id == lz4_dict_id(dict) &&
+                 decompress_frame_matches_with_dict(aml_buffer_data(frame), aml_buffer_length(frame), src, len,
+                                                    dict) &&
+                 !decompress_frame_matches(aml_buffer_data(frame), aml_buffer_length(frame), src, len) &&
+                 !decompress_frame_matches_with_dict(aml_buffer_data(frame), aml_buffer_length(frame), src, len,
+                                                     other);
+            lz4_destroy(c);
+        }
+    }
+
+    if (ok)
+        printf("Dictionary test passed: %zu vs %zu bytes\n", with_dict, plain);
+    else {
+        printf("Dictionary test failed: %zu vs %zu bytes\n", with_dict, plain);
+        failures++;
+    }
+    lz4_dict_destroy(other);
+    aml_buffer_destroy(frame);
+    free(src);
+    aml_buffer_destroy(compressed);
+    lz4_dict_destroy(dict);
+    aml_buffer_destroy(trained);
+    free(samples);
+}
+
+void test_lz4_incompressible_blocks() {
+    printf("\nRunning LZ4 incompressible block test...\n");
+
+    /* random 64KB blocks alternate with text, repeating the random data in a
+       later block gives linked blocks something to reference */
+    size_t block = 64 * 1024, len = 8 * block;
+    char *src = (char *)malloc(len);
+    srand(11);
+    for (size_t b = 0; b < 8; b++) {
+        char *p = src + b * block;
+        if (b == 6)
+            memcpy(p, src + 4 * block, block);
+        else if (b % 2 == 0)
+            for (size_t i = 0; i < block; i++)
+                p[i] = (char)rand();
+        else
+            fill_log_lines(p, block);
+    }
+
+    bool ok = true;
+    int levels[] = {1, 9};
+    for (int linked = 0; linked < 2; linked++) {
+        for (size_t i = 0; i < 2; i++) {
+            lz4_t *c = linked ? lz4_init_linked(levels[i], s64kb, true, true) : lz4_init(levels[i], s64kb, true, true);
+            ok = ok && round_trip_frame(c, src, len) != 0;
+            lz4_stats_t stats;
+            lz4_get_stats(c, &stats);
+            /* linked blocks are always compressed as they have history */
+            ok = ok && stats.blocks == 8 && stats.skipped_blocks == (linked ? 0 : 4) && stats.stored_blocks == 4;
+            lz4_destroy(c);
+        }
+    }
+
+    /* random data repeated within the 64KB window compresses */
+    size_t big = 256 * 1024, pattern = 16 * 1024;
+    char *repeated = (char *)malloc(big);
+    for (size_t i = 0; i < pattern; i++)
+        repeated[i] = (char)rand();
+    for (size_t i = pattern; i < big; i += pattern)
+        memcpy(repeated + i, repeated, pattern);
+    lz4_t *c = lz4_init(1, s256kb, false, false);
+    char *dest = (char *)malloc(lz4_compressed_size(c));
+    lz4_stats_t stats;
+    uint32_t n = lz4_compress_block(c, repeated, big, dest, lz4_compressed_size(c));
+    lz4_get_stats(c, &stats);
+    ok = ok && n < big / 8 && stats.skipped_blocks == 0 && stats.stored_blocks == 0;
+
+    /* the check can be turned off, random data is then compressed and stored */
+    lz4_set_skip_incompressible(c, false);
+    n = lz4_compress_block(c, src, block, dest, lz4_compressed_size(c));
+    lz4_get_stats(c, &stats);
+    ok = ok && n == block + 4 && stats.skipped_blocks == 0 && stats.stored_blocks == 1;
+    lz4_destroy(c);
+    free(dest);
+    free(repeated);
+
+    /* a linked HC frame of a random block followed by the second half of it
+       twice (within the 64KB window): the random block is stored and the next
+       one is compressed against it, also when dest leaves no room for the HC
+       compressor to finish the random block */
+    char *copies = (char *)malloc(2 * block);
+    memcpy(copies, src, block);
+    memcpy(copies + block, src + block / 2, block / 2);
+    memcpy(copies + block + block / 2, src + block / 2, block / 2);
+    for (int tight = 0; tight < 2; tight++) {
+        c = lz4_init_linked(9, s64kb, true, true);
+        aml_buffer_t *frame = aml_buffer_init(1024);
+        uint32_t header_size;
+        const char *header = lz4_get_header(c, &header_size);
+        aml_buffer_append(frame, header, header_size);
+        dest = (char *)malloc(lz4_compressed_size(c));
+        uint32_t dest_len = tight ? block + lz4_block_header_size(c) : lz4_compressed_size(c);
+        uint32_t first = lz4_compress_block(c, copies, block, dest, dest_len);
+        aml_buffer_append(frame, dest, first);
+        uint32_t second = lz4_compress_block(c, copies + block, block, dest, dest_len);
+        aml_buffer_append(frame, dest, second);
+        aml_buffer_append(frame, dest, lz4_finish(c, dest));
+        ok = ok && first == block + lz4_block_header_size(c) && second < 1024 &&
+             decompress_frame_matches(aml_buffer_data(frame), aml_buffer_length(frame), copies, 2 * block);
+        lz4_destroy(c);
+        aml_buffer_destroy(frame);
+        free(dest);
+    }
+    free(copies);
+
+    /* small blocks aren't sampled, the compressor gives up once the output
+       reaches the size of the block */
+    c = lz4_init(9, s64kb, false, false);
+    dest = (char *)malloc(lz4_compressed_size(c));
+    ok = ok && lz4_compress_block(c, src, 4096, dest, lz4_compressed_size(c)) == 4096 + 4 &&
+         (dest[3] & 0x80) && !memcmp(dest + 4, src, 4096);
+    lz4_get_stats(c, &stats);
+    ok = ok && stats.stored_blocks == 1 && stats.skipped_blocks == 0;
+    lz4_destroy(c);
+    free(dest);
+
+    if (ok)
+        printf("Incompressible block test passed.\n");
+    else {
+        printf("Incompressible block test failed.\n");
+        failures++;
+    }
+    free(src);
+}
+
+void test_lz4_decompress_view() {
+    printf("\nRunning LZ4 decompress view test...\n");
+
+    /* text and random blocks, linked so that stored blocks are history */
+    size_t block = 64 * 1024, len = 6 * block;
+    char *src = (char *)malloc(len);
+    srand(17);
+    for (size_t b = 0; b < 6; b++) {
+        if (b % 2)
+            for (size_t i = 0; i < block; i++)
+                src[b * block + i] = (char)rand();
+        else
+            fill_log_lines(src + b * block, block);
+    }
+    memcpy(src + 4 * block + 1000, src + block + 500, 2000);
+
+    bool ok = true;
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    lz4_t *c = lz4_init_linked(1, s64kb, true, true);
+    compress_frame(c, frame, src, len);
+    lz4_destroy(c);
+
+    const char *f = aml_buffer_data(frame);
+    lz4_header_t h;
+    lz4_check_header(&h, (void *)f, LZ4_MAX_HEADER_SIZE);
+    lz4_t *d = lz4_init_decompress((void *)f, h.header_size);
+    char *out = (char *)malloc(block);
+    size_t pos = h.header_size, out_len = 0, stored = 0;
+    while (ok) {
+        uint32_t v;
+        memcpy(&v, f + pos, 4);
+        pos += 4;
+        if (!v)
+            break;
+        bool compressed = !(v & 0x80000000U);
+        uint32_t n = (v & 0x7FFFFFFFU) + lz4_block_header_size(d);
+        const void *data;
+        int r = lz4_decompress_view(d, f + pos, n, out, block, compressed, &data);
+        ok = r > 0 && out_len + r <= len && !memcmp(data, src + out_len, r) &&
+             data == (compressed ? (const void *)out : (const void *)(f + pos));
+        stored += compressed ? 0 : 1;
+        out_len += r;
+        pos += n;
+    }
+    ok = ok && out_len == len && stored == 3 && lz4_finish(d, (void *)(f + pos)) >= 0;
+    lz4_destroy(d);
+
+    if (ok)
+        printf("Decompress view test passed.\n");
+    else {
+        printf("Decompress view test failed.\n");
+        failures++;
+    }
+    free(out);
+    aml_buffer_destroy(frame);
+    free(src);
+}
+
+/* reads all of file into dest */
+static void read_file(FILE *file, aml_buffer_t *dest) {
+    char buf[4096];
+    size_t n;
+    rewind(file);
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        aml_buffer_append(dest, buf, n);
+}
+
+void test_lz4_writer() {
+    printf("\nRunning LZ4 writer test...\n");
+
+    size_t len = 1024 * 1024 + 777;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+
+    bool ok = true;
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    for (int use_fd = 0; use_fd < 2; use_fd++) {
+        FILE *file = tmpfile();
+        lz4_t *c = use_fd ? lz4_init_linked(9, s64kb, true, true) : lz4_init(1, s64kb, false, true);
+        lz4_enable_seek_table(c);
+        lz4_writer_t *w = use_fd ? lz4_writer_init(fileno(file), c) : lz4_writer_init_file(file, c);
+        /* writes of varying size, some of them larger than a block */
+        size_t pos = 0, n = 1;
+        while (pos < len) {
+            if (n > len - pos)
+                n = len - pos;
+            ok = ok && lz4_writer_write(w, src + pos, n);
+            pos += n;
+            n = n * 3 % 200000 + 1;
+        }
+        ok = lz4_writer_close(w) && ok;
+        lz4_destroy(c);
+
+        aml_buffer_clear(frame);
+        read_file(file, frame);
+        fclose(file);
+        lz4_seekable_t *r = lz4_seekable_init(aml_buffer_data(frame), aml_buffer_length(frame));
+        ok = ok && decompress_frame_matches(aml_buffer_data(frame), aml_buffer_length(frame), src, len) &&
+             (use_fd ? !r : r && lz4_seekable_size(r) == len);
+        if (r)
+            lz4_seekable_destroy(r);
+    }
+
+    /* a failed write is reported */
+    int fds[2];
+    if (pipe(fds) == 0) {
+        close(fds[0]);
+        lz4_t *c = lz4_init(1, s64kb, false, false);
+        lz4_writer_t *w = lz4_writer_init(fds[1], c);
+        lz4_writer_write(w, src, len);
+        ok = ok && !lz4_writer_close(w);
+        lz4_destroy(c);
+        close(fds[1]);
+    }
+
+    if (ok)
+        printf("Writer test passed.\n");
+    else {
+        printf("Writer test failed.\n");
+        failures++;
+    }
+    aml_buffer_destroy(frame);
+    free(src);
+}
+
+/* reads all of r with reads of varying size (small reads and reads of
+   several blocks) and compares it with src */
+static bool reader_matches(lz4_reader_t *r, const char *src, size_t len) {
+    size_t out_size = len + 1024;
+    char *out = (char *)malloc(out_size);
+    size_t pos = 0, n = 1;
+    bool ok = true;
+    while (true) {
+        if (n > out_size - pos)
+            n = out_size - pos;
+        int64_t got = lz4_reader_read(r, out + pos, n);
+        if (got < 0 || (size_t)got > n) {
+            ok = false;
+            break;
+        }
+        pos += got;
+        if ((size_t)got < n)
+            break;
+        n = n * 7 % 300000 + 1;
+    }
+    ok = ok && pos == len && !memcmp(out, src, len) && lz4_reader_read(r, out, 1) == 0;
+    free(out);
+    return ok;
+}
+
+void test_lz4_reader() {
+    printf("\nRunning LZ4 reader test...\n");
+
+    size_t len = 1024 * 1024 + 12345;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+
+    bool ok = true;
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    for (int linked = 0; linked < 2; linked++) {
+        lz4_t *c = linked ? lz4_init_linked(1, s64kb, true, true) : lz4_init(9, s256kb, false, true);
+        aml_buffer_clear(frame);
+        compress_frame(c, frame, src, len);
+        lz4_destroy(c);
+
+        lz4_reader_t *r = lz4_reader_init_memory(aml_buffer_data(frame), aml_buffer_length(frame));
+        ok = ok && r && lz4_reader_header(r)->linked_blocks == (linked != 0) && reader_matches(r, src, len);
+        if (r)
+            lz4_reader_destroy(r);
+
+        FILE *file = tmpfile();
+        fwrite(aml_buffer_data(frame), 1, aml_buffer_length(frame), file);
+        fflush(file);
+        rewind(file);
+        r = lz4_reader_init(fileno(file));
+        ok = ok && r && reader_matches(r, src, len);
+        if (r)
+            lz4_reader_destroy(r);
+        fclose(file);
+    }
+
+    /* a corrupt content checksum is reported after the data */
+    aml_buffer_data(frame)[aml_buffer_length(frame) - 1] ^= 1;
+    lz4_reader_t *r = lz4_reader_init_memory(aml_buffer_data(frame), aml_buffer_length(frame));
+    char *out = (char *)malloc(len + 1);
+    ok = ok && lz4_reader_read(r, out, len + 1) == (int64_t)len && lz4_reader_read(r, out, 1) == -500;
+    lz4_reader_destroy(r);
+
+    /* a truncated frame */
+    r = lz4_reader_init_memory(aml_buffer_data(frame), aml_buffer_length(frame) / 2);
+    int64_t n = lz4_reader_read(r, out, len + 1);
+    ok = ok && n > 0 && n < (int64_t)len && lz4_reader_read(r, out, 1) == -1;
+    lz4_reader_destroy(r);
+    ok = ok && !lz4_reader_init_memory("not a frame", 11);
+
+    if (ok)
+        printf("Reader test passed.\n");
+    else {
+        printf("Reader test failed.\n");
+        failures++;
+    }
+    free(out);
+    aml_buffer_destroy(frame);
+    free(src);
+}
+
+static bool write_file(const char *path, const void *data, size_t len) {
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(data, 1, len, file) == len;
+    return fclose(file) == 0 && ok;
+}
+
+static bool file_matches(const char *path, const char *src, size_t len) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    aml_buffer_t *data = aml_buffer_init(1024);
+    read_file(file, data);
+    fclose(file);
+    bool ok = aml_buffer_length(data) == len && !memcmp(aml_buffer_data(data), src, len);
+    aml_buffer_destroy(data);
+    return ok;
+}
+
+void test_lz4_file() {
+    printf("\nRunning LZ4 file test...\n");
+
+    char src_path[] = "/tmp/lz4_file_src_XXXXXX";
+    char frame_path[] = "/tmp/lz4_file_frame_XXXXXX";
+    char out_path[] = "/tmp/lz4_file_out_XXXXXX";
+    close(mkstemp(src_path));
+    close(mkstemp(frame_path));
+    close(mkstemp(out_path));
+
+    size_t len = 3 * 1024 * 1024 + 99;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+
+    bool ok = true;
+    size_t lens[] = {len, 1000, 0};
+    for (size_t i = 0; i < 3; i++) {
+        ok = ok && write_file(src_path, src, lens[i]);
+        lz4_t *c = lz4_init(1, s1mb, true, true);
+        int64_t frame_len = lz4_compress_file(c, src_path, frame_path);
+        lz4_destroy(c);
+        ok = ok && frame_len > 0 && lz4_decompress_file(frame_path, out_path) == (int64_t)lens[i] &&
+             file_matches(out_path, src, lens[i]);
+    }
+
+    /* without a content size, blocks are written from a buffer */
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    lz4_t *c = lz4_init_linked(9, s64kb, false, true);
+    compress_frame(c, frame, src, len);
+    lz4_destroy(c);
+    ok = ok && write_file(frame_path, aml_buffer_data(frame), aml_buffer_length(frame)) &&
+         lz4_decompress_file(frame_path, out_path) == (int64_t)len && file_matches(out_path, src, len);
+
+    /* a corrupt frame removes the output */
+    aml_buffer_data(frame)[aml_buffer_length(frame) - 1] ^= 1;
+    ok = ok && write_file(frame_path, aml_buffer_data(frame), aml_buffer_length(frame)) &&
+         lz4_decompress_file(frame_path, out_path) == -500 && access(out_path, F_OK) != 0;
+
+    /* a content size of 1TB for a few bytes isn't used to size the output */
+    lz4_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.size = s64kb;
+    h.has_content_size = true;
+    h.content_size = (uint64_t)1 << 40;
+    aml_buffer_clear(frame);
+    char header[LZ4_MAX_HEADER_SIZE];
+    aml_buffer_append(frame, header, lz4_write_header(header, &h));
+    aml_buffer_append(frame, "\x0A\x00\x00\x80" "0123456789" "\x00\x00\x00\x00", 18);
+    ok = ok && write_file(frame_path, aml_buffer_data(frame), aml_buffer_length(frame)) &&
+         lz4_decompress_file(frame_path, out_path) == -1 && access(out_path, F_OK) != 0;
+    aml_buffer_destroy(frame);
+
+    if (ok)
+        printf("File test passed.\n");
+    else {
+        printf("File test failed.\n");
+        failures++;
+    }
+    unlink(src_path);
+    unlink(frame_path);
+    unlink(out_path);
+    free(src);
+}
+
+void test_lz4_async() {
+    printf("\nRunning LZ4 async file test (%s)...\n", lz4_async_uses_io_uring() ? "io_uring" : "threads");
+
+    size_t len = 2 * 1024 * 1024 + 4321;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+    /* an incompressible stretch gives stored blocks */
+    srand(5);
+    for (size_t i = 300000; i < 500000; i++)
+        src[i] = (char)rand();
+
+    bool ok = true;
+    size_t lens[] = {len, 100, 0};
+    for (size_t i = 0; i < 3; i++) {
+        FILE *src_file = tmpfile(), *frame_file = tmpfile(), *out_file = tmpfile();
+        fwrite(src, 1, lens[i], src_file);
+        fflush(src_file);
+        /* the output is truncated to the result */
+        fwrite(src, 1, 5000, frame_file);
+        fwrite(src, 1, len, out_file);
+        fflush(frame_file);
+        fflush(out_file);
+
+        lz4_t *c = lz4_init(i ? 9 : 1, s64kb, true, true);
+        int64_t frame_len = lz4_async_compress(c, fileno(src_file), fileno(frame_file), 3);
+        lz4_destroy(c);
+        aml_buffer_t *frame = aml_buffer_init(1024);
+        read_file(frame_file, frame);
+        ok = ok && frame_len == (int64_t)aml_buffer_length(frame) &&
+             decompress_frame_matches(aml_buffer_data(frame), aml_buffer_length(frame), src, lens[i]) &&
+             lz4_async_decompress(fileno(frame_file), fileno(out_file), 4) == (int64_t)lens[i];
+        aml_buffer_clear(frame);
+        read_file(out_file, frame);
+        ok = ok && aml_buffer_length(frame) == lens[i] && !memcmp(aml_buffer_data(frame), src, lens[i]);
+        aml_buffer_destroy(frame);
+        fclose(src_file);
+        fclose(frame_file);
+        fclose(out_file);
+    }
+
+    /* linked blocks, a corrupt block checksum */
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    lz4_t *c = lz4_init_linked(1, s64kb, true, true);
+    compress_frame(c, frame, src, len);
+    lz4_destroy(c);
+    for (int corrupt = 0; corrupt < 2; corrupt++) {
+        if (corrupt)
+            aml_buffer_data(frame)[aml_buffer_length(frame) / 2] ^= 1;
+        FILE *frame_file = tmpfile(), *out_file = tmpfile();
+        fwrite(aml_buffer_data(frame), 1, aml_buffer_length(frame), frame_file);
+        fflush(frame_file);
+        int64_t r = lz4_async_decompress(fileno(frame_file), fileno(out_file), 0);
+        ok = ok && (corrupt ? r < 0 : r == (int64_t)len);
+        fclose(frame_file);
+        fclose(out_file);
+    }
+    aml_buffer_destroy(frame);
+
+    if (ok)
+        printf("Async file test passed.\n");
+    else {
+        printf("Async file test failed.\n");
+        failures++;
+    }
+    free(src);
+}
+
+typedef struct {
+    lz4_dict_t *dict;
+    int level;
+    bool ok;
+} shared_dictionary_arg_t;
+
+static void *shared_dictionary_thread(void *arg) {
+    shared_dictionary_arg_t *a = (shared_dictionary_arg_t *)arg;
+    a->ok = true;
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    char src[16 * 1024];
+    for (unsigned int i = 0; i < 20 && a->ok; i++) {
+        /* a short lived context per "connection" */
+        size_t len = 0;
+        for (unsigned int j = 0; len + 256 < sizeof(src); j++)
+            len += fill_document(src + len, 256, i * 1000 + j);
+        lz4_t *c = lz4_init(a->level, s64kb, true, false);
+        lz4_set_dictionary(c, a->dict);
+        aml_buffer_clear(frame);
+        compress_frame(c, frame, src, len);
+        lz4_destroy(c);
+        a->ok = decompress_frame_matches_with_dict(aml_buffer_data(frame), aml_buffer_length(frame), src, len,
+                                                   a->dict);
+    }
+    aml_buffer_destroy(frame);
+    lz4_dict_release(a->dict);
+    return NULL;
+}
+
+void test_lz4_shared_dictionary() {
+    printf("\nRunning LZ4 shared dictionary test...\n");
+
+    char dict_data[8 * 1024];
+    size_t dict_size = 0;
+    for (unsigned int i = 0; dict_size + 256 < sizeof(dict_data); i++)
+        dict_size += fill_document(dict_data + dict_size, 256, 100000 + i);
+    lz4_dict_t *dict = lz4_dict_init(dict_data, dict_size, 0);
+
+    /* each thread holds its own reference, the dictionary outlives the
+       creator's reference */
+    enum { NUM_THREADS = 4 };
+    pthread_t threads[NUM_THREADS];
+    shared_dictionary_arg_t args[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        args[i].dict = lz4_dict_retain(dict);
+        args[i].level = i % 2 ? 9 : 1;
+        pthread_create(&threads[i], NULL, shared_dictionary_thread, &args[i]);
+    }
+    lz4_dict_destroy(dict);
+
+    bool ok = true;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        ok = ok && args[i].ok;
+    }
+    if (ok)
+        printf("Shared dictionary test passed.\n");
+    else {
+        printf("Shared dictionary test failed.\n");
+        failures++;
+    }
+}
+
+void test_lz4_hash3() {
+    unsigned char data[4096];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (unsigned char)(i * 31 % 251);
+
+    /* reference values from xxHash */
+    lz4_hash128_t empty = lz4_hash3_128("", 0, 0);
+    lz4_hash128_t h = lz4_hash3_128(data, sizeof(data), 42);
+    bool ok = lz4_hash3_64("", 0, 0) == 0x2D06800538D394C2ULL &&
+              empty.low == 0x6001C324468D497FULL && empty.high == 0x99AA06D3014798D8ULL &&
+              lz4_hash3_64(data, sizeof(data), 0) == 0xF2506E94C3D12D24ULL &&
+              lz4_hash3_64(data, sizeof(data), 42) == 0x1550BBFA21C70588ULL &&
+              h.low == 0x1550BBFA21C70588ULL && h.high == 0x81F556C49FB9C35AULL;
+
+    /* streaming in uneven pieces matches hashing at once, across the short,
+       medium and long input paths */
+    lz4_hash3_t *state = lz4_hash3_init(0);
+    for (size_t len = 0; ok && len <= sizeof(data); len += len < 300 ? 1 : 97) {
+        uint64_t seed = len & 1 ? len : 0;
+        lz4_hash3_reset(state, seed);
+        for (size_t pos = 0; pos < len; pos += 13)
+            lz4_hash3_update(state, data + pos, len - pos < 13 ? len - pos : 13);
+        lz4_hash128_t h128 = lz4_hash3_128(data, len, seed);
+        lz4_hash128_t d128 = lz4_hash3_digest128(state);
+        ok = lz4_hash3_digest64(state) == lz4_hash3_64(data, len, seed) &&
+             d128.low == h128.low && d128.high == h128.high;
+    }
+    lz4_hash3_destroy(state);
+
+    if (ok)
+        printf("XXH3 hash test passed (%s).\n", lz4_hash3_kernel());
+    else {
+        printf("XXH3 hash test failed.\n");
+        failures++;
+    }
+}
+
+void test_lz4_hash64_batch() {
+    enum { NUM_KEYS = 203 };
+    char data[NUM_KEYS * 72];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (char)(i * 131 + (i >> 7));
+
+    const void *keys[NUM_KEYS];
+    size_t lens[NUM_KEYS];
+    uint64_t out[NUM_KEYS];
+    bool ok = true;
+    for (size_t i = 0; i < NUM_KEYS; i++) {
+        keys[i] = data + i * 71;
+        lens[i] = i % 72;
+    }
+    lz4_hash64_batch(keys, lens, out, NUM_KEYS);
+    for (size_t i = 0; i < NUM_KEYS; i++)
+        ok = ok && out[i] == lz4_hash64(keys[i], lens[i]);
+
+    for (size_t key_len = 0; key_len <= 72; key_len++) {
+        lz4_hash64_batch_fixed(data, key_len, out, NUM_KEYS);
+        for (size_t i = 0; i < NUM_KEYS; i++)
+            ok = ok && out[i] == lz4_hash64(data + i * key_len, key_len);
+    }
+
+    if (ok)
+        printf("Batch hash test passed.\n");
+    else {
+        printf("Batch hash test failed.\n");
+        failures++;
+    }
+}
+
+void test_lz4_hash3_tree() {
+    size_t len = LZ4_HASH3_TREE_CHUNK_SIZE * 5 + 1234;
+    char *data = (char *)malloc(len);
+    fill_log_lines(data, len);
+
+    /* the tree computed with the single buffer functions */
+    size_t num_chunks = 6;
+    unsigned char leaves[6 * 16 + 8];
+    for (size_t i = 0; i < num_chunks; i++) {
+        size_t pos = i * LZ4_HASH3_TREE_CHUNK_SIZE;
+        size_t n = len - pos < LZ4_HASH3_TREE_CHUNK_SIZE ? len - pos : LZ4_HASH3_TREE_CHUNK_SIZE;
+        lz4_hash128_t h = lz4_hash3_128(data + pos, n, 7);
+        memcpy(leaves + i * 16, &h.low, 8);
+        memcpy(leaves + i * 16 + 8, &h.high, 8);
+    }
+    uint64_t len64 = len;
+    memcpy(leaves + num_chunks * 16, &len64, 8);
+    uint64_t expected = lz4_hash3_64(leaves, sizeof(leaves), 7);
+
+    bool ok = expected != lz4_hash3_64(data, len, 7);
+    for (int threads = 0; threads <= 8; threads++)
+        ok = ok && lz4_hash3_tree(data, len, 7, threads) == expected;
+
+    /* a single (or empty) chunk is still hashed as a tree */
+    lz4_hash128_t leaf = lz4_hash3_128(data, 100, 0);
+    memcpy(leaves, &leaf.low, 8);
+    memcpy(leaves + 8, &leaf.high, 8);
+    len64 = 100;
+    memcpy(leaves + 16, &len64, 8);
+    ok = ok && lz4_hash3_tree(data, 100, 0, 4) == lz4_hash3_64(leaves, 24, 0);
+    ok = ok && lz4_hash3_tree(data, 0, 0, 4) != lz4_hash3_tree(data, 0, 1, 4);
+    free(data);
+
+    if (ok)
+        printf("Tree hash test passed.\n");
+    else {
+        printf("Tree hash test failed.\n");
+        failures++;
+    }
+}
+
+void test_lz4_kernels() {
+    printf("\nRunning LZ4 kernel test...\n");
+
+    size_t len = 1024 * 1024;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+    /* some long literal runs and long matches at large offsets */
+    unsigned int x = 1;
+    for (size_t i = 0; i < len / 4; i++) {
+        x = x * 1103515245u + 12345u;
+        src[len / 2 + i] = (char)(x >> 24);
+    }
+    memcpy(src + len / 2 + len / 4, src + len / 2, len / 8);
+
+    const char *original = lz4_kernels();
+    const char *names[] = {"baseline", "avx2"};
+    int levels[] = {1, -2, 9};
+    aml_buffer_t *expected[3][2];
+    bool ok = !lz4_set_kernels("unknown") && !strcmp(lz4_kernels(), original);
+    int tested = 0;
+    for (size_t k = 0; k < 2; k++) {
+        if (!lz4_set_kernels(names[k]))
+            continue;
+        tested++;
+        for (size_t i = 0; i < 3; i++) {
+            for (int linked = 0; linked < 2; linked++) {
+                lz4_t *c = linked ? lz4_init_linked(levels[i], s64kb, true, true)
+                                  : lz4_init(levels[i], s64kb, true, true);
+                aml_buffer_t *frame = aml_buffer_init(1024);
+                compress_frame(c, frame, src, len);
+                lz4_destroy(c);
+                ok = ok && decompress_frame_matches(aml_buffer_data(frame), aml_buffer_length(frame), src, len);
+                /* every kernel produces the same frames */
+                if (!k)
+                    expected[i][linked] = frame;
+                else {
+                    ok = ok && aml_buffer_length(frame) == aml_buffer_length(expected[i][linked]) &&
+                         !memcmp(aml_buffer_data(frame), aml_buffer_data(expected[i][linked]),
+                                 aml_buffer_length(frame));
+                    aml_buffer_destroy(frame);
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < 3; i++)
+        for (int linked = 0; linked < 2; linked++)
+            aml_buffer_destroy(expected[i][linked]);
+    ok = ok && tested >= 1 && lz4_set_kernels(original) && !strcmp(lz4_kernels(), original);
+    free(src);
+
+    if (ok)
+        printf("Kernel test passed (%s selected, %d kernels compared).\n", original, tested);
+    else {
+        printf("Kernel test failed.\n");
+        failures++;
+    }
+}
+
+void test_lz4_stats() {
+    printf("\nRunning LZ4 stats test...\n");
+
+    size_t len = 1024 * 1024;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+
+    lz4_t *c = lz4_init(1, s64kb, true, true);
+    lz4_enable_timing(c, true);
+    aml_buffer_t *frame = aml_buffer_init(1024);
+    compress_frame(c, frame, src, len);
+    uint32_t header_size;
+    lz4_get_header(c, &header_size);
+    lz4_stats_t stats;
+    lz4_get_stats(c, &stats);
+    /* everything but the header, end mark and content checksum */
+    size_t blocks_len = aml_buffer_length(frame) - header_size - 8;
+    bool ok = stats.blocks == 16 && stats.stored_blocks == 0 && stats.bytes == len &&
+              stats.compressed_bytes == blocks_len && stats.checksum_failures == 0 && stats.compress_ns > 0 &&
+              stats.checksum_ns > 0 && stats.decompress_ns == 0;
+    lz4_reset_stats(c);
+    lz4_get_stats(c, &stats);
+    ok = ok && stats.blocks == 0 && stats.bytes == 0 && stats.compress_ns == 0;
+    lz4_destroy(c);
+
+    /* decompress, then again with a corrupt block and content checksum */
+    char *out = (char *)malloc(64 * 1024);
+    for (int corrupt = 0; corrupt < 2; corrupt++) {
+        char *p = aml_buffer_data(frame);
+        lz4_t *d = lz4_init_decompress(p, header_size);
+        lz4_enable_timing(d, !corrupt);
+        char *end = p + aml_buffer_length(frame) - 4;
+        if (corrupt) {
+            /* the checksum of the first block and the content checksum */
+            uint32_t v;
+            memcpy(&v, p + header_size, 4);
+            p[header_size + 4 + (v & 0x7FFFFFFFU)] ^= 1;
+            *end ^= 1;
+        }
+        int failed = 0;
+        for (p += header_size; p < end - 4;) {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            uint32_t n = (v & 0x7FFFFFFFU) + lz4_block_header_size(d);
+            if (lz4_decompress(d, p + 4, n, out, 64 * 1024, !(v & 0x80000000U)) < 0)
+                failed++;
+            p += 4 + n;
+        }
+        if (lz4_finish(d, end) < 0)
+            failed++;
+        lz4_get_stats(d, &stats);
+        if (corrupt)
+            ok = ok && failed == 2 && stats.checksum_failures == 2 && stats.blocks == 15 &&
+                 stats.decompress_ns == 0 && stats.checksum_ns == 0;
+        else
+            ok = ok && failed == 0 && stats.checksum_failures == 0 && stats.blocks == 16 && stats.bytes == len &&
+                 stats.compressed_bytes == blocks_len && stats.decompress_ns > 0 && stats.checksum_ns > 0 &&
+                 stats.compress_ns == 0;
+        lz4_destroy(d);
+    }
+    free(out);
+    aml_buffer_destroy(frame);
+    free(src);
+
+    if (ok)
+        printf("Stats test passed.\n");
+    else {
+        printf("Stats test failed.\n");
+        failures++;
+    }
+}
+
+void test_lz4_adaptive() {
+    printf("\nRunning LZ4 adaptive level test...\n");
+
+    size_t len = 1024 * 1024;
+    char *src = (char *)malloc(len);
+    fill_log_lines(src, len);
+
+    /* without a target every block is compressed at the highest level */
+    lz4_t *c = lz4_init_adaptive(-5, 9, s64kb, true, true);
+    bool ok = lz4_level(c) == 9 && round_trip_frame(c, src, len) && lz4_level(c) == 9;
+    lz4_destroy(c);
+
+    /* a target no level can keep up with steps down to the lowest level */
+    c = lz4_init_adaptive(-5, 9, s64kb, true, true);
+    lz4_set_target_speed(c, 1e9);
+    ok = ok && lz4_level(c) == 1 && round_trip_frame(c, src, len) && lz4_level(c) == -5;
+    lz4_destroy(c);
+
+    /* and one every level can keep up with steps up to the highest */
+    c = lz4_init_adaptive(-5, 9, s64kb, true, true);
+    lz4_set_block_budget(c, 1000000000000ULL);
+    ok = ok && round_trip_frame(c, src, len) && lz4_level(c) == 9;
+    lz4_destroy(c);
+
+    /* a fixed level context ignores the target */
+    c = lz4_init(4, s64kb, true, true);
+    lz4_set_target_speed(c, 1e9);
+    ok = ok && round_trip_frame(c, src, len) && lz4_level(c) == 4;
+    lz4_destroy(c);
+    free(src);
+
+    if (ok)
+        printf("Adaptive level test passed.\n");
+    else {
+        printf("Adaptive level test failed.\n");
+        failures++;
+    }
+}
+
 int main() {
+    /* the writer test writes to a closed pipe */
+    signal(SIGPIPE, SIG_IGN);
     test_lz4_compression_and_decompression();
     test_lz4_block_compression();
-    return 0;
+    test_lz4_linked_blocks();
+    test_lz4_parallel_compression();
+    test_lz4_parallel_decompression();
+    test_lz4_seekable();
+    test_lz4_frame_header();
+    test_lz4_records();
+    test_lz4_incompressible_blocks();
+    test_lz4_decompress_view();
+    test_lz4_writer();
+    test_lz4_reader();
+    test_lz4_file();
+    test_lz4_async();
+    test_lz4_dictionary();
+    test_lz4_shared_dictionary();
+    test_lz4_hash3();
+    test_lz4_hash64_batch();
+    test_lz4_hash3_tree();
+    test_lz4_kernels();
+    test_lz4_stats();
+    test_lz4_adaptive();
+    return failures ? 1 : 0;
 }